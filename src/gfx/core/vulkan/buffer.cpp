@@ -1,14 +1,15 @@
 #include "buffer.hpp"
 #include "allocator.hpp"
 #include "device.hpp"
-#include "util/allocators/range_allocator.hpp"
+#include "util/allocators/ring_allocator.hpp"
 #include "util/util.hpp"
+#include <algorithm>
 #include <boost/container/small_vector.hpp>
 #include <optional>
 #include <source_location>
+#include <utility>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
-#include <vulkan/vulkan_hash.hpp>
 
 namespace gfx::core::vulkan
 {
@@ -17,6 +18,37 @@ namespace gfx::core::vulkan
 
     static constexpr std::size_t StagingBufferSize = std::size_t {32} * 1024 * 1024;
 
+    void coalesceFlushes(std::vector<FlushData>& flushes, vk::DeviceSize maxGapBytes)
+    {
+        if (flushes.size() < 2)
+        {
+            return;
+        }
+
+        std::ranges::sort(flushes, {}, &FlushData::offset_bytes);
+
+        usize merged = 0;
+
+        for (usize i = 1; i < flushes.size(); ++i)
+        {
+            FlushData&           last    = flushes[merged];
+            const FlushData&     next    = flushes[i];
+            const vk::DeviceSize lastEnd = last.offset_bytes + last.size_bytes;
+
+            if (next.offset_bytes <= lastEnd + maxGapBytes)
+            {
+                last.size_bytes = std::max(lastEnd, next.offset_bytes + next.size_bytes) - last.offset_bytes;
+            }
+            else
+            {
+                merged += 1;
+                flushes[merged] = next;
+            }
+        }
+
+        flushes.resize(merged + 1);
+    }
+
     BufferStager::BufferStager(const Renderer* renderer_)
         : renderer {renderer_}
         , staging_buffer {
@@ -26,132 +58,66 @@ namespace gfx::core::vulkan
               "Staging Buffer",
               std::nullopt
           }
-        , transfer_allocator {util::RangeAllocator {StagingBufferSize, 1024 * 128}}
-        , transfers {std::vector<BufferTransfer> {}}
+        , transfer_queue {this->staging_buffer.getGpuDataNonCoherent()}
     {}
 
-    BufferStager::~BufferStager()
-    {
-        this->transfer_allocator.lock(
-            [this](util::RangeAllocator& allocator)
-            {
-                this->transfers.lock(
-                    [&](std::vector<BufferTransfer>& ts)
-                    {
-                        for (BufferTransfer& t : ts)
-                        {
-                            allocator.free(std::move(t.staging_allocation));
-                        }
-                    });
-
-                this->transfers_to_free.lock(
-                    [&](std::unordered_map<std::shared_ptr<vk::UniqueFence>, std::vector<BufferTransfer>>& tsMap)
-                    {
-                        for (auto& [_, ts] : tsMap)
-                        {
-                            for (BufferTransfer& t : ts)
-                            {
-                                allocator.free(std::move(t.staging_allocation));
-                            }
-                        }
-                    });
-            });
-    }
+    BufferStager::~BufferStager() = default;
 
     void BufferStager::enqueueByteTransfer(
         vk::Buffer buffer, u32 offset, std::span<const std::byte> dataToWrite, std::source_location location) const
     {
-        this->enqueueByteTransfer(
-            buffer, offset, std::vector<std::byte> {dataToWrite.begin(), dataToWrite.end()}, location);
+        this->transfer_queue.enqueueByteTransfer(buffer, offset, dataToWrite, location);
     }
 
     void BufferStager::enqueueByteTransfer(
         vk::Buffer buffer, u32 offset, std::vector<std::byte> dataToWrite, std::source_location location) const
     {
-        assert::critical<std::size_t>(
-            dataToWrite.size() < StagingBufferSize / 2,
-            "Buffer::enqueueByteTransfer of size {} is too large",
-            dataToWrite.size(),
-            location);
-
-        assert::warn<std::size_t>(
-            dataToWrite.size() > 0,
-            "BufferStager::enqueueByteTransfer of size {} is too small",
-            dataToWrite.size(),
-            location);
-
-        std::expected<util::RangeAllocation, util::RangeAllocator::OutOfBlocks> maybeAllocation =
-            this->transfer_allocator.lock(
-                [&](util::RangeAllocator& a)
-                {
-                    return a.tryAllocate(static_cast<u32>(dataToWrite.size()));
-                });
-
-        if (maybeAllocation.has_value())
-        {
-            this->allocated += dataToWrite.size();
+        this->transfer_queue.enqueueByteTransfer(buffer, offset, std::move(dataToWrite), location);
+    }
 
-            std::span<std::byte> stagingBufferData = this->staging_buffer.getGpuDataNonCoherent();
+    BufferStager::UploadToken BufferStager::enqueueStreamedByteTransfer(
+        vk::Buffer buffer, u32 offset, std::vector<std::byte> dataToWrite, std::source_location location) const
+    {
+        return this->transfer_queue.enqueueStreamedByteTransfer(buffer, offset, std::move(dataToWrite), location);
+    }
 
-            // static_assert(std::is_trivially_copyable_v<std::byte>);
-            std::memcpy(
-                stagingBufferData.data() + util::RangeAllocator::getOffsetofAllocation(*maybeAllocation),
-                dataToWrite.data(),
-                dataToWrite.size());
+    std::optional<BufferStager::Reservation>
+    BufferStager::reserveByteTransfer(vk::Buffer buffer, u32 offset, u32 size, u32 alignment) const
+    {
+        return this->transfer_queue.reserveByteTransfer(buffer, offset, size, alignment);
+    }
 
-            this->transfers.lock(
-                [&](std::vector<BufferTransfer>& t)
-                {
-                    t.push_back(BufferTransfer {
-                        .staging_allocation {std::move(*maybeAllocation)},
-                        .output_buffer {buffer},
-                        .output_offset {offset},
-                        .size {static_cast<u32>(dataToWrite.size())},
-                    });
-                });
-        }
-        else
-        {
-            // shit we need to overflow
+    void BufferStager::commit(Reservation reservation) const
+    {
+        this->transfer_queue.commit(std::move(reservation));
+    }
 
-            this->overflow_transfers.lock(
-                [&](std::vector<OverflowTransfer>& overflowTransfers)
-                {
-                    overflowTransfers.push_back({OverflowTransfer {
-                        .buffer {buffer}, .offset {offset}, .data {std::move(dataToWrite)}, .location {location}}});
-                });
-        }
+    void BufferStager::cancel(Reservation reservation) const
+    {
+        this->transfer_queue.cancel(std::move(reservation));
     }
 
     void BufferStager::cleanupCompletedTransfers() const
     {
-        // Free all allocations that have already completed.
-        this->transfers_to_free.lock(
-            [&](std::unordered_map<std::shared_ptr<vk::UniqueFence>, std::vector<BufferTransfer>>& toFreeMap)
+        // Fences signal in submission order, so stop at the first one that hasn't
+        this->retirements.lock(
+            [&](std::deque<PendingRetirement>& pending)
             {
-                std::vector<std::shared_ptr<vk::UniqueFence>> toRemove {};
-
-                for (auto& [fence, allocations] : toFreeMap)
+                while (!pending.empty()
+                       && this->renderer->getDevice()->getDevice().getFenceStatus(**pending.front().fence)
+                              == vk::Result::eSuccess)
                 {
-                    if (this->renderer->getDevice()->getDevice().getFenceStatus(**fence) == vk::Result::eSuccess)
+                    if (pending.front().ring_position.has_value())
                     {
-                        toRemove.push_back(fence);
-
-                        this->transfer_allocator.lock(
-                            [&](util::RangeAllocator& stagingAllocator)
-                            {
-                                for (BufferTransfer& transfer : allocations)
-                                {
-                                    this->allocated -= transfer.size;
-                                    stagingAllocator.free(std::move(transfer.staging_allocation));
-                                }
-                            });
+                        this->transfer_queue.release(*pending.front().ring_position);
                     }
-                }
 
-                for (const std::shared_ptr<vk::UniqueFence>& f : toRemove)
-                {
-                    toFreeMap.erase(f);
+                    for (const std::shared_ptr<std::atomic<bool>>& complete : pending.front().completed_uploads)
+                    {
+                        complete->store(true, std::memory_order_release);
+                    }
+
+                    pending.pop_front();
                 }
             });
     }
@@ -159,68 +125,83 @@ namespace gfx::core::vulkan
     void BufferStager::flushTransfers(
         vk::CommandBuffer commandBuffer, std::shared_ptr<vk::UniqueFence> flushFinishFence) const
     {
-        std::vector<BufferTransfer> grabbedTransfers = this->transfers.moveInner();
+        TransferQueue::Flush flush = this->transfer_queue.flush();
+
+        const std::span<const TransferQueue::Transfer> grabbedTransfers = flush.transfers;
+        std::vector<vk::BufferCopy>&                   bufferCopies     = this->flush_buffer_copies;
+        std::vector<FlushData>&                        stagingFlushes   = this->flush_staging_ranges;
 
-        std::unordered_map<vk::Buffer, std::vector<vk::BufferCopy>> copies {};
-        std::vector<FlushData>                                      stagingFlushes {};
+        stagingFlushes.clear();
 
-        for (const BufferTransfer& transfer : grabbedTransfers)
+        for (usize runStart = 0; runStart < grabbedTransfers.size();)
         {
-            if (transfer.size == 0)
+            const vk::Buffer outputBuffer = grabbedTransfers[runStart].output_buffer;
+
+            usize runEnd = runStart;
+
+            bufferCopies.clear();
+
+            for (; runEnd < grabbedTransfers.size() && grabbedTransfers[runEnd].output_buffer == outputBuffer; ++runEnd)
             {
-                log::warn("zst transfer!");
+                const TransferQueue::Transfer& transfer = grabbedTransfers[runEnd];
 
-                continue;
-            }
-            const u32 offset = util::RangeAllocator::getOffsetofAllocation(transfer.staging_allocation);
+                if (transfer.size == 0)
+                {
+                    log::warn("zst transfer!");
 
-            copies[transfer.output_buffer].push_back(vk::BufferCopy {
-                .srcOffset {offset},
-                .dstOffset {transfer.output_offset},
-                .size {transfer.size},
-            });
+                    continue;
+                }
+                const u32 offset = transfer.staging_offset;
 
-            stagingFlushes.push_back(FlushData {.offset_bytes {offset}, .size_bytes {transfer.size}});
-        }
+                // Consecutive transfers that are contiguous in both buffers become one region
+                if (!bufferCopies.empty() && bufferCopies.back().srcOffset + bufferCopies.back().size == offset
+                    && bufferCopies.back().dstOffset + bufferCopies.back().size == transfer.output_offset)
+                {
+                    bufferCopies.back().size += transfer.size;
+                }
+                else
+                {
+                    bufferCopies.push_back(vk::BufferCopy {
+                        .srcOffset {offset},
+                        .dstOffset {transfer.output_offset},
+                        .size {transfer.size},
+                    });
+                }
+
+                stagingFlushes.push_back(FlushData {.offset_bytes {offset}, .size_bytes {transfer.size}});
+            }
 
-        for (const auto& [outputBuffer, bufferCopies] : copies)
-        {
             if (bufferCopies.size() > 4096)
             {
                 log::warn("Excessive copies on buffer {}", bufferCopies.size());
             }
-            commandBuffer.copyBuffer(*this->staging_buffer, outputBuffer, bufferCopies);
-        }
-
-        this->staging_buffer.flush(stagingFlushes);
 
-        this->transfers_to_free.lock(
-            [&](std::unordered_map<std::shared_ptr<vk::UniqueFence>, std::vector<BufferTransfer>>& toFreeMap)
+            if (!bufferCopies.empty())
             {
-                toFreeMap[flushFinishFence].insert(
-                    toFreeMap[flushFinishFence].begin(),
-                    std::make_move_iterator(grabbedTransfers.begin()),
-                    std::make_move_iterator(grabbedTransfers.end()));
-            });
+                commandBuffer.copyBuffer(*this->staging_buffer, outputBuffer, bufferCopies);
+            }
 
-        {
-            std::vector<OverflowTransfer> overflows = this->overflow_transfers.moveInner();
+            runStart = runEnd;
+        }
 
-            if (!overflows.empty())
-            {
-                log::warn("{} buffer transfer overflows this frame!", overflows.size());
-            }
+        coalesceFlushes(stagingFlushes, 0);
+
+        this->staging_buffer.flush(stagingFlushes);
 
-            for (OverflowTransfer& t : overflows)
+        this->retirements.lock(
+            [&](std::deque<PendingRetirement>& pending)
             {
-                this->enqueueByteTransfer(t.buffer, t.offset, std::move(t.data), t.location);
-            }
-        }
+                pending.push_back(PendingRetirement {
+                    .fence {std::move(flushFinishFence)},
+                    .ring_position {flush.ring_position},
+                    .completed_uploads {std::move(flush.completed_uploads)},
+                });
+            });
     }
 
     std::pair<std::size_t, std::size_t> BufferStager::getUsage() const
     {
-        return {this->allocated.load(), StagingBufferSize};
+        return {this->transfer_queue.getBytesInUse(), this->transfer_queue.getCapacity()};
     }
 
 } // namespace gfx::core::vulkan
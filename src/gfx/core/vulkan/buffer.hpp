@@ -5,13 +5,19 @@
 #include "device.hpp"
 #include "gfx/core/renderer.hpp"
 #include "gfx/core/vulkan/buffer.hpp"
-#include "util/allocators/range_allocator.hpp"
+#include "transfer_queue.hpp"
+#include "util/allocators/ring_allocator.hpp"
 #include "util/logger.hpp"
+#include "util/threads.hpp"
 #include "util/util.hpp"
 #include <atomic>
 #include <bit>
+#include <deque>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <source_location>
+#include <span>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -31,6 +37,10 @@ namespace gfx::core::vulkan
         vk::DeviceSize size_bytes;
     };
 
+    /// Sorts the ranges and merges every pair that overlaps, touches, or is separated by at most maxGapBytes,
+    /// leaving the fewest ranges that cover everything
+    void coalesceFlushes(std::vector<FlushData>&, vk::DeviceSize maxGapBytes);
+
     extern std::atomic<std::size_t> bufferBytesAllocated;            // NOLINT
     extern std::atomic<std::size_t> hostVisibleBufferBytesAllocated; // NOLINT
 
@@ -452,6 +462,8 @@ namespace gfx::core::vulkan
     class CpuCachedBuffer : public WriteOnlyBuffer<T>
     {
     public:
+        // Holes this small between dirty ranges are uploaded too, one larger copy is cheaper than two
+        static constexpr vk::DeviceSize DefaultFlushMergeGapBytes = 256;
 
         CpuCachedBuffer(
             const Renderer*         renderer_,
@@ -469,6 +481,7 @@ namespace gfx::core::vulkan
                   std::move(name_),
                   maybeDescriptorBindingLocation,
                   loc}
+            , flush_merge_gap_bytes {DefaultFlushMergeGapBytes}
         {
             assert::warn(
                 static_cast<bool>(vk::BufferUsageFlagBits::eTransferDst | usage_),
@@ -498,8 +511,14 @@ namespace gfx::core::vulkan
             : WriteOnlyBuffer<T> {std::move(other)}
             , cpu_buffer {std::move(other.cpu_buffer)}
             , flushes {std::move(other.flushes)}
+            , flush_merge_gap_bytes {other.flush_merge_gap_bytes}
         {}
 
+        void setFlushMergeGap(vk::DeviceSize maxGapBytes)
+        {
+            this->flush_merge_gap_bytes = maxGapBytes;
+        }
+
         std::span<const T> read(std::size_t offset, std::size_t size) const
         {
             return std::span<const T> {&this->cpu_buffer[offset], size};
@@ -511,7 +530,7 @@ namespace gfx::core::vulkan
 
         void write(std::size_t offset, std::span<const T> data)
         {
-            this->flushes.push_back(FlushData {.offset_bytes {offset * sizeof(T)}, .size_bytes {data.size_bytes()}});
+            this->pushFlush(FlushData {.offset_bytes {offset * sizeof(T)}, .size_bytes {data.size_bytes()}});
 
             std::memcpy(&this->cpu_buffer[offset], data.data(), data.size_bytes());
         }
@@ -526,7 +545,7 @@ namespace gfx::core::vulkan
         {
             const std::size_t byteOffset = util::getOffsetOfPointerToMember(Ptr);
 
-            this->flushes.push_back(
+            this->pushFlush(
                 FlushData {.offset_bytes {(offsetElements * sizeof(T)) + byteOffset}, .size_bytes {sizeof(write)}});
 
             std::memcpy(reinterpret_cast<char*>(&this->cpu_buffer[offsetElements]) + byteOffset, &write, sizeof(write));
@@ -536,7 +555,7 @@ namespace gfx::core::vulkan
         {
             assert::critical(size > 0, "dont do this");
 
-            this->flushes.push_back(FlushData {.offset_bytes {offset * sizeof(T)}, .size_bytes {size * sizeof(T)}});
+            this->pushFlush(FlushData {.offset_bytes {offset * sizeof(T)}, .size_bytes {size * sizeof(T)}});
 
             return std::span<T> {&this->cpu_buffer[offset], size};
         }
@@ -552,7 +571,7 @@ namespace gfx::core::vulkan
         {
             const std::size_t byteOffset = util::getOffsetOfPointerToMember(Ptr);
 
-            this->flushes.push_back(FlushData {
+            this->pushFlush(FlushData {
                 .offset_bytes {(offsetElements * sizeof(T)) + byteOffset},
                 .size_bytes {sizeof(util::MemberTypeT<decltype(Ptr)>)}});
 
@@ -566,7 +585,7 @@ namespace gfx::core::vulkan
             std::size_t elementInternalModifiedOffsetStart,
             std::size_t elementInternalModifiedSize)
         {
-            this->flushes.push_back(FlushData {
+            this->pushFlush(FlushData {
                 .offset_bytes {(storedArrayElement * sizeof(T)) + elementInternalModifiedOffsetStart},
                 .size_bytes {elementInternalModifiedSize}});
 
@@ -580,7 +599,7 @@ namespace gfx::core::vulkan
             std::size_t elementInternalModifiedOffsetStart,
             std::size_t elementInternalModifiedOffsetEnd)
         {
-            this->flushes.push_back(FlushData {
+            this->pushFlush(FlushData {
                 .offset_bytes {(storedArrayElement * sizeof(T)) + elementInternalModifiedOffsetStart},
                 .size_bytes {elementInternalModifiedOffsetEnd - elementInternalModifiedOffsetStart}});
 
@@ -590,10 +609,11 @@ namespace gfx::core::vulkan
         void flushViaStager(const BufferStager& stager, std::source_location = std::source_location::current());
         void flushCachedChangesImmediate()
         {
-            std::vector<FlushData> localFlushes = this->grabFlushes();
-            const std::span<T>     gpuData      = this->getGpuDataNonCoherent();
+            coalesceFlushes(this->flushes, this->flush_merge_gap_bytes);
+
+            const std::span<T> gpuData = this->getGpuDataNonCoherent();
 
-            for (FlushData& f : localFlushes)
+            for (const FlushData& f : this->flushes)
             {
                 static_assert(std::is_trivially_copyable_v<T>);
                 std::memcpy(
@@ -602,20 +622,51 @@ namespace gfx::core::vulkan
                     f.size_bytes);
             }
 
-            this->flush(std::move(localFlushes));
+            this->flush(this->flushes);
+
+            // cleared rather than moved out so the list's capacity is reused every frame
+            this->flushes.clear();
         }
 
         std::vector<FlushData> grabFlushes()
         {
+            coalesceFlushes(this->flushes, this->flush_merge_gap_bytes);
+
             return std::move(this->flushes);
         }
     private:
+        // Writes usually walk forwards, so most ranges can be merged into the previous one straight away.
+        // Everything else is merged by coalesceFlushes when flushing
+        void pushFlush(FlushData flush)
+        {
+            if (!this->flushes.empty())
+            {
+                FlushData&           last    = this->flushes.back();
+                const vk::DeviceSize lastEnd = last.offset_bytes + last.size_bytes;
+
+                if (flush.offset_bytes >= last.offset_bytes
+                    && flush.offset_bytes <= lastEnd + this->flush_merge_gap_bytes)
+                {
+                    last.size_bytes = std::max(lastEnd, flush.offset_bytes + flush.size_bytes) - last.offset_bytes;
+
+                    return;
+                }
+            }
+
+            this->flushes.push_back(flush);
+        }
+
         std::vector<T>         cpu_buffer;
         std::vector<FlushData> flushes;
+        vk::DeviceSize         flush_merge_gap_bytes;
     };
 
     class BufferStager
     {
+    public:
+        using Reservation = TransferQueue::Reservation;
+        using UploadToken = TransferQueue::UploadToken;
+
     public:
 
         explicit BufferStager(const Renderer*);
@@ -641,9 +692,52 @@ namespace gfx::core::vulkan
                 location);
         }
 
+        /// Transfers that are too large or don't fit in the staging buffer right now fall back to being streamed.
+        /// So do ones that overlap a streamed upload that is still waiting, so they can't land before it
         void enqueueByteTransfer(vk::Buffer, u32 offset, std::span<const std::byte>, std::source_location) const;
         void enqueueByteTransfer(vk::Buffer, u32 offset, std::vector<std::byte>, std::source_location) const;
 
+        /// Uploads of any size, split into pieces and staged over as many frames as there is room for.
+        /// Transfers enqueued after it that overlap it land after it, others aren't held back
+        template<class T>
+            requires std::is_trivially_copyable_v<T>
+        [[nodiscard]] UploadToken enqueueStreamedTransfer(
+            const GpuOnlyBuffer<T>& buffer,
+            u32                     offset,
+            std::span<const T>      data,
+            std::source_location    location = std::source_location::current()) const
+        {
+            // NOLINTNEXTLINE
+            const std::byte* const bytes = reinterpret_cast<const std::byte*>(data.data());
+
+            return this->enqueueStreamedByteTransfer(
+                *buffer,
+                static_cast<u32>(offset * sizeof(T)),
+                std::vector<std::byte> {bytes, bytes + data.size_bytes()},
+                location);
+        }
+        [[nodiscard]] UploadToken
+        enqueueStreamedByteTransfer(vk::Buffer, u32 offset, std::vector<std::byte>, std::source_location) const;
+
+        /// Returns std::nullopt if the staging buffer is out of space or the range overlaps a streamed upload that
+        /// is still waiting, fall back to enqueueTransfer in that case
+        template<class T>
+            requires std::is_trivially_copyable_v<T>
+        [[nodiscard]] std::optional<Reservation>
+        reserveTransfer(const GpuOnlyBuffer<T>& buffer, u32 offset, u32 numberOfElements) const
+        {
+            return this->reserveByteTransfer(
+                *buffer,
+                static_cast<u32>(offset * sizeof(T)),
+                static_cast<u32>(numberOfElements * sizeof(T)),
+                alignof(T));
+        }
+        [[nodiscard]] std::optional<Reservation>
+        reserveByteTransfer(vk::Buffer, u32 offset, u32 size, u32 alignment) const;
+        /// The reservation's contents are uploaded by the next flushTransfers
+        void commit(Reservation) const;
+        void cancel(Reservation) const;
+
         void cleanupCompletedTransfers() const;
         void flushTransfers(vk::CommandBuffer, std::shared_ptr<vk::UniqueFence> flushFinishFence) const;
 
@@ -651,40 +745,32 @@ namespace gfx::core::vulkan
 
     private:
 
-        struct BufferTransfer
+        // Once the fence signals the staging ring can be released up to ring_position. A flush whose mark is still
+        // waiting on open reservations has no position, its space is released by the next flush that has one
+        struct PendingRetirement
         {
-            util::RangeAllocation staging_allocation;
-            vk::Buffer            output_buffer;
-            u32                   output_offset;
-            u32                   size;
+            std::shared_ptr<vk::UniqueFence>                fence;
+            std::optional<util::RingAllocator::Position>    ring_position;
+            std::vector<std::shared_ptr<std::atomic<bool>>> completed_uploads;
         };
 
-        mutable std::atomic<std::size_t>                      allocated;
         const Renderer*                                       renderer;
         mutable gfx::core::vulkan::WriteOnlyBuffer<std::byte> staging_buffer;
 
-        struct OverflowTransfer
-        {
-            vk::Buffer             buffer;
-            u32                    offset;
-            std::vector<std::byte> data;
-            std::source_location   location;
-        };
+        TransferQueue                              transfer_queue;
+        util::Mutex<std::deque<PendingRetirement>> retirements;
 
-        util::Mutex<std::vector<OverflowTransfer>> overflow_transfers;
-
-        util::Mutex<util::RangeAllocator>        transfer_allocator;
-        util::Mutex<std::vector<BufferTransfer>> transfers;
-        util::Mutex<std::unordered_map<std::shared_ptr<vk::UniqueFence>, std::vector<BufferTransfer>>>
-            transfers_to_free;
+        // Only touched by flushTransfers, kept so that their capacity is reused every flush
+        mutable std::vector<vk::BufferCopy> flush_buffer_copies;
+        mutable std::vector<FlushData>      flush_staging_ranges;
     };
 
     template<class T>
     void CpuCachedBuffer<T>::flushViaStager(const BufferStager& stager, std::source_location location)
     {
-        std::vector<FlushData> mergedFlushes = this->grabFlushes();
+        coalesceFlushes(this->flushes, this->flush_merge_gap_bytes);
 
-        for (const FlushData& f : mergedFlushes)
+        for (const FlushData& f : this->flushes)
         {
             assert::critical(f.offset_bytes < static_cast<u64>(std::numeric_limits<u32>::max()), "oop offset ");
             assert::critical(f.size_bytes < static_cast<u64>(std::numeric_limits<u32>::max()), "oop size");
@@ -695,6 +781,8 @@ namespace gfx::core::vulkan
                 {reinterpret_cast<const std::byte*>(this->cpu_buffer.data()) + f.offset_bytes, f.size_bytes},
                 location);
         }
+
+        this->flushes.clear();
     }
 
 } // namespace gfx::core::vulkan
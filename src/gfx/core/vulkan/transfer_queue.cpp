@@ -0,0 +1,487 @@
+#include "transfer_queue.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <tuple>
+
+namespace gfx::core::vulkan
+{
+    TransferQueue::TransferQueue(std::span<std::byte> stagingMemory)
+        : staging_memory {stagingMemory}
+        , staging_allocator {stagingMemory.size()}
+        , number_of_streamed_uploads {0}
+    {}
+
+    void TransferQueue::enqueueByteTransfer(
+        vk::Buffer buffer, u32 offset, std::span<const std::byte> dataToWrite, std::source_location location) const
+    {
+        assert::warn<std::size_t>(
+            dataToWrite.size() > 0,
+            "TransferQueue::enqueueByteTransfer of size {} is too small",
+            dataToWrite.size(),
+            location);
+
+        // Only a streamed transfer needs its own copy of the data
+        if (this->mustStream(buffer, offset, dataToWrite.size()) || !this->tryStageBytes(buffer, offset, dataToWrite))
+        {
+            std::ignore = this->enqueueStreamedByteTransfer(
+                buffer, offset, std::vector<std::byte> {dataToWrite.begin(), dataToWrite.end()}, location);
+        }
+    }
+
+    void TransferQueue::enqueueByteTransfer(
+        vk::Buffer buffer, u32 offset, std::vector<std::byte> dataToWrite, std::source_location location) const
+    {
+        assert::warn<std::size_t>(
+            dataToWrite.size() > 0,
+            "TransferQueue::enqueueByteTransfer of size {} is too small",
+            dataToWrite.size(),
+            location);
+
+        if (this->mustStream(buffer, offset, dataToWrite.size()) || !this->tryStageBytes(buffer, offset, dataToWrite))
+        {
+            std::ignore = this->enqueueStreamedByteTransfer(buffer, offset, std::move(dataToWrite), location);
+        }
+    }
+
+    TransferQueue::UploadToken TransferQueue::enqueueStreamedByteTransfer(
+        vk::Buffer buffer, u32 offset, std::vector<std::byte> dataToWrite, std::source_location location) const
+    {
+        UploadToken token {};
+        token.complete = std::make_shared<std::atomic<bool>>(false);
+
+        this->streamed_uploads.lock(
+            [&](std::vector<StreamedUpload>& uploads)
+            {
+                this->number_of_streamed_uploads.fetch_add(1, std::memory_order_release);
+
+                uploads.push_back(StreamedUpload {
+                    .buffer {buffer},
+                    .offset {offset},
+                    .data {std::move(dataToWrite)},
+                    .bytes_staged {0},
+                    .complete {token.complete},
+                    .location {location},
+                });
+            });
+
+        return token;
+    }
+
+    std::vector<std::shared_ptr<std::atomic<bool>>> TransferQueue::streamUploads() const
+    {
+        std::vector<StreamedPiece>& pieces = this->flush_streamed_pieces;
+        // Small enough that a streamed upload leaves room for everything else staged in the same flush
+        const usize                 streamedPieceSize = this->getCapacity() / 4;
+
+        usize numberFullyStaged = 0;
+
+        // Strictly in order, a later upload may overlap an earlier one
+        this->streamed_uploads.lock(
+            [&](std::vector<StreamedUpload>& uploads)
+            {
+                for (StreamedUpload& upload : uploads)
+                {
+                    const usize bytesStagedBefore = upload.bytes_staged;
+
+                    while (upload.bytes_staged < upload.data.size())
+                    {
+                        const usize pieceSize = std::min(upload.data.size() - upload.bytes_staged, streamedPieceSize);
+
+                        std::optional<Reservation> maybeReservation = this->tryReserveBytes(
+                            upload.buffer,
+                            static_cast<u32>(upload.offset + upload.bytes_staged),
+                            static_cast<u32>(pieceSize),
+                            1);
+
+                        if (!maybeReservation.has_value())
+                        {
+                            break;
+                        }
+
+                        // Moving an upload when the list grows keeps its data where it is
+                        pieces.push_back(StreamedPiece {
+                            .reservation {std::move(*maybeReservation)},
+                            .source {upload.data.data() + upload.bytes_staged},
+                        });
+
+                        upload.bytes_staged += pieceSize;
+                    }
+
+                    if (upload.bytes_staged < upload.data.size())
+                    {
+                        // Large uploads are expected to take a few frames and stall while earlier pieces retire
+                        if (upload.bytes_staged == bytesStagedBefore)
+                        {
+                            log::debug<usize>(
+                                "{} buffer transfers are waiting for staging space",
+                                uploads.size() - numberFullyStaged,
+                                upload.location);
+                        }
+
+                        break;
+                    }
+
+                    numberFullyStaged += 1;
+                }
+            });
+
+        // Copied outside the lock so that enqueueing isn't held up. The uploads stay in the list until their pieces
+        // are committed, nothing overlapping them can be staged ahead of them in the meantime
+        for (StreamedPiece& piece : pieces)
+        {
+            std::memcpy(piece.reservation.bytes.data(), piece.source, piece.reservation.bytes.size());
+
+            this->commit(std::move(piece.reservation));
+        }
+
+        pieces.clear();
+
+        std::vector<std::shared_ptr<std::atomic<bool>>> fullyStaged {};
+
+        if (numberFullyStaged == 0)
+        {
+            return fullyStaged;
+        }
+
+        // Only we remove uploads, so they are still at the front
+        this->streamed_uploads.lock(
+            [&](std::vector<StreamedUpload>& uploads)
+            {
+                const auto fullyStagedEnd = uploads.begin() + static_cast<isize>(numberFullyStaged);
+
+                for (auto it = uploads.begin(); it != fullyStagedEnd; ++it)
+                {
+                    fullyStaged.push_back(std::move(it->complete));
+                }
+
+                uploads.erase(uploads.begin(), fullyStagedEnd);
+
+                this->number_of_streamed_uploads.fetch_sub(
+                    static_cast<u32>(numberFullyStaged), std::memory_order_release);
+            });
+
+        return fullyStaged;
+    }
+
+    bool TransferQueue::tryStageBytes(vk::Buffer buffer, u32 offset, std::span<const std::byte> dataToWrite) const
+    {
+        std::optional<Reservation> maybeReservation =
+            this->tryReserveBytes(buffer, offset, static_cast<u32>(dataToWrite.size()), 1);
+
+        if (!maybeReservation.has_value())
+        {
+            return false;
+        }
+
+        std::memcpy(maybeReservation->bytes.data(), dataToWrite.data(), dataToWrite.size());
+
+        this->commit(std::move(*maybeReservation));
+
+        return true;
+    }
+
+    std::optional<TransferQueue::Reservation>
+    TransferQueue::reserveByteTransfer(vk::Buffer buffer, u32 offset, u32 size, u32 alignment) const
+    {
+        if (this->mustStream(buffer, offset, size))
+        {
+            return std::nullopt;
+        }
+
+        return this->tryReserveBytes(buffer, offset, size, alignment);
+    }
+
+    bool TransferQueue::mustStream(vk::Buffer buffer, u32 offset, usize size) const
+    {
+        if (size >= this->getCapacity() / 2)
+        {
+            return true;
+        }
+
+        // Lock free while nothing is being streamed, which is nearly always
+        if (this->number_of_streamed_uploads.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+
+        return this->streamed_uploads.lock(
+            [&](const std::vector<StreamedUpload>& uploads)
+            {
+                return std::ranges::any_of(
+                    uploads,
+                    [&](const StreamedUpload& upload)
+                    {
+                        return upload.buffer == buffer && offset < upload.offset + upload.data.size()
+                            && upload.offset < offset + size;
+                    });
+            });
+    }
+
+    std::optional<TransferQueue::Reservation>
+    TransferQueue::tryReserveBytes(vk::Buffer buffer, u32 offset, u32 size, u32 alignment) const
+    {
+        if (size >= this->getCapacity() / 2)
+        {
+            return std::nullopt;
+        }
+
+        const std::optional<util::RingAllocator::Allocation> maybeAllocation =
+            this->staging_allocator.tryAllocate(size, alignment);
+
+        if (!maybeAllocation.has_value())
+        {
+            return std::nullopt;
+        }
+
+        const u64 stagingOffset = maybeAllocation->offset;
+
+        Reservation reservation {};
+        reservation.staging_allocator  = &this->staging_allocator;
+        reservation.staging_allocation = *maybeAllocation;
+        reservation.bytes              = this->staging_memory.subspan(stagingOffset, size);
+        reservation.output_buffer      = buffer;
+        reservation.output_offset      = offset;
+
+        return reservation;
+    }
+
+    void TransferQueue::commit(Reservation reservation) const
+    {
+        assert::critical(
+            reservation.staging_allocator == &this->staging_allocator,
+            "Committed a TransferQueue::Reservation that was already given back or isn't from this queue");
+
+        this->transfers.push(Transfer {
+            .staging_offset {static_cast<u32>(reservation.staging_allocation.offset)},
+            .output_buffer {reservation.output_buffer},
+            .output_offset {reservation.output_offset},
+            .size {static_cast<u32>(reservation.bytes.size())},
+        });
+
+        // Only after the transfer is visible to flush(), otherwise a flush could retire its space without
+        // having uploaded it
+        reservation.close();
+    }
+
+    void TransferQueue::cancel(Reservation reservation) const
+    {
+        assert::critical(
+            reservation.staging_allocator == &this->staging_allocator,
+            "Cancelled a TransferQueue::Reservation that was already given back or isn't from this queue");
+
+        // The ring can only be released in order, the space is reclaimed along with everything around it
+        reservation.close();
+    }
+
+    void TransferQueue::sortTransfersByBuffer(std::vector<Transfer>& transfers, std::vector<Transfer>& scratch)
+    {
+        // LSD radix sort over the handle's bytes. Handles mostly share their upper bytes, so passes where every
+        // transfer has the same digit are skipped
+        static constexpr u32 DigitBits      = 8;
+        static constexpr u32 NumberOfPasses = 64 / DigitBits;
+        static constexpr u32 DigitsPerPass  = 1u << DigitBits;
+
+        if (transfers.size() < 2)
+        {
+            return;
+        }
+
+        const auto getKey = [](const Transfer& t)
+        {
+            return std::bit_cast<u64>(static_cast<VkBuffer>(t.output_buffer));
+        };
+
+        std::array<std::array<u32, DigitsPerPass>, NumberOfPasses> histograms {};
+
+        for (const Transfer& t : transfers)
+        {
+            const u64 key = getKey(t);
+
+            for (u32 pass = 0; pass < NumberOfPasses; ++pass)
+            {
+                histograms[pass][(key >> (pass * DigitBits)) & (DigitsPerPass - 1)] += 1;
+            }
+        }
+
+        for (u32 pass = 0; pass < NumberOfPasses; ++pass)
+        {
+            std::array<u32, DigitsPerPass>& histogram = histograms[pass];
+
+            if (std::ranges::find(histogram, static_cast<u32>(transfers.size())) != histogram.end())
+            {
+                continue;
+            }
+
+            u32 runningOffset = 0;
+
+            for (u32& count : histogram)
+            {
+                runningOffset += std::exchange(count, runningOffset);
+            }
+
+            scratch.resize(transfers.size());
+
+            for (const Transfer& t : transfers)
+            {
+                scratch[histogram[(getKey(t) >> (pass * DigitBits)) & (DigitsPerPass - 1)]++] = t;
+            }
+
+            transfers.swap(scratch);
+        }
+    }
+
+    void TransferQueue::trimOverwrittenBytes() const
+    {
+        std::vector<Transfer>& transfers = this->flush_transfers;
+        std::vector<Transfer>& trimmed   = this->flush_sort_scratch;
+        std::vector<u32>&      order     = this->flush_overlap_order;
+        std::vector<u32>&      live      = this->flush_overlap_live;
+
+        const auto getEnd = [&](u32 i)
+        {
+            return u64 {transfers[i].output_offset} + transfers[i].size;
+        };
+
+        trimmed.clear();
+
+        for (usize runStart = 0; runStart < transfers.size();)
+        {
+            const vk::Buffer outputBuffer = transfers[runStart].output_buffer;
+
+            usize runEnd = runStart;
+
+            order.clear();
+
+            for (; runEnd < transfers.size() && transfers[runEnd].output_buffer == outputBuffer; ++runEnd)
+            {
+                order.push_back(static_cast<u32>(runEnd));
+            }
+
+            // The run is in commit order, so ties keep the older write first
+            std::ranges::sort(
+                order,
+                [&](u32 l, u32 r)
+                {
+                    return std::tie(transfers[l].output_offset, l) < std::tie(transfers[r].output_offset, r);
+                });
+
+            u64  coveredEnd = 0;
+            bool overlaps   = false;
+
+            for (const u32 i : order)
+            {
+                overlaps |= transfers[i].output_offset < coveredEnd;
+                coveredEnd = std::max(coveredEnd, getEnd(i));
+            }
+
+            if (!overlaps)
+            {
+                for (const u32 i : order)
+                {
+                    trimmed.push_back(transfers[i]);
+                }
+
+                runStart = runEnd;
+
+                continue;
+            }
+
+            // Sweep along the buffer keeping the transfers that cover the current position in a heap on commit
+            // order, every byte comes from the newest of them. Ones that have ended are only popped once they reach
+            // the top
+            live.clear();
+
+            usize next     = 0;
+            u64   position = 0;
+
+            while (next < order.size() || !live.empty())
+            {
+                if (live.empty())
+                {
+                    position = transfers[order[next]].output_offset;
+                }
+
+                for (; next < order.size() && transfers[order[next]].output_offset <= position; ++next)
+                {
+                    live.push_back(order[next]);
+                    std::ranges::push_heap(live);
+                }
+
+                while (!live.empty() && getEnd(live.front()) <= position)
+                {
+                    std::ranges::pop_heap(live);
+                    live.pop_back();
+                }
+
+                if (live.empty())
+                {
+                    continue;
+                }
+
+                const Transfer& newest = transfers[live.front()];
+
+                // Until the newest ends or another starts, which may be newer still
+                u64 segmentEnd = getEnd(live.front());
+
+                if (next < order.size())
+                {
+                    segmentEnd = std::min(segmentEnd, u64 {transfers[order[next]].output_offset});
+                }
+
+                const u32 stagingOffset = newest.staging_offset + static_cast<u32>(position - newest.output_offset);
+                const u32 size          = static_cast<u32>(segmentEnd - position);
+
+                if (!trimmed.empty() && trimmed.back().output_buffer == outputBuffer
+                    && trimmed.back().output_offset + trimmed.back().size == position
+                    && trimmed.back().staging_offset + trimmed.back().size == stagingOffset)
+                {
+                    trimmed.back().size += size;
+                }
+                else
+                {
+                    trimmed.push_back(Transfer {
+                        .staging_offset {stagingOffset},
+                        .output_buffer {outputBuffer},
+                        .output_offset {static_cast<u32>(position)},
+                        .size {size},
+                    });
+                }
+
+                position = segmentEnd;
+            }
+
+            runStart = runEnd;
+        }
+
+        transfers.swap(trimmed);
+    }
+
+    TransferQueue::Flush TransferQueue::flush() const
+    {
+        std::vector<std::shared_ptr<std::atomic<bool>>> completedUploads = this->streamUploads();
+
+        // Must be marked before draining, every transfer in the ring below the mark is then in this flush or an
+        // earlier one
+        const std::optional<util::RingAllocator::Position> ringPosition = this->staging_allocator.tryMark();
+
+        this->flush_transfers.clear();
+        this->transfers.drain(this->flush_transfers);
+
+        sortTransfersByBuffer(this->flush_transfers, this->flush_sort_scratch);
+        this->trimOverwrittenBytes();
+
+        return Flush {
+            .transfers {this->flush_transfers},
+            .ring_position {ringPosition},
+            .completed_uploads {std::move(completedUploads)},
+        };
+    }
+
+    void TransferQueue::release(util::RingAllocator::Position position) const
+    {
+        this->staging_allocator.release(position);
+    }
+} // namespace gfx::core::vulkan
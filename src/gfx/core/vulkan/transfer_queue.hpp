@@ -0,0 +1,224 @@
+#pragma once
+
+#include "util/allocators/ring_allocator.hpp"
+#include "util/logger.hpp"
+#include "util/threads.hpp"
+#include "util/util.hpp"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <source_location>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx::core::vulkan
+{
+    /// The cpu side of BufferStager, which only adds the gpu commands and fences.
+    /// Transfers are staged into a ring over caller provided memory. flush() hands back everything staged since the
+    /// last one grouped by buffer, along with the ring position they can be released up to once the gpu has copied
+    /// them. Where transfers to a buffer overlap only the bytes of the newest are kept, so that the flush can be
+    /// copied in any order.
+    class TransferQueue
+    {
+    public:
+        struct Transfer
+        {
+            u32        staging_offset;
+            vk::Buffer output_buffer;
+            u32        output_offset;
+            u32        size;
+        };
+
+        /// Space in the staging memory that the caller fills in place instead of handing over a copy.
+        /// Must be given back to commit() or cancel(), one that is dropped is cancelled so the ring isn't stalled
+        class Reservation
+        {
+        public:
+            Reservation() = default;
+            ~Reservation()
+            {
+                if (this->staging_allocator != nullptr)
+                {
+                    log::warn("TransferQueue::Reservation of {} bytes was dropped, cancelling", this->bytes.size());
+
+                    this->close();
+                }
+            }
+
+            Reservation(const Reservation&) = delete;
+            Reservation(Reservation&& other) noexcept
+                : staging_allocator {std::exchange(other.staging_allocator, nullptr)}
+                , staging_allocation {other.staging_allocation}
+                , bytes {other.bytes}
+                , output_buffer {other.output_buffer}
+                , output_offset {other.output_offset}
+            {}
+            Reservation& operator= (const Reservation&) = delete;
+            Reservation& operator= (Reservation&& other) noexcept
+            {
+                if (this == &other)
+                {
+                    return *this;
+                }
+
+                this->~Reservation();
+
+                new (this) Reservation {std::move(other)};
+
+                return *this;
+            }
+
+            [[nodiscard]] std::span<std::byte> getBytes() const
+            {
+                return this->bytes;
+            }
+
+            template<class T>
+                requires std::is_trivially_copyable_v<T>
+            [[nodiscard]] std::span<T> getData() const
+            {
+                // NOLINTNEXTLINE
+                return std::span<T> {reinterpret_cast<T*>(this->bytes.data()), this->bytes.size() / sizeof(T)};
+            }
+
+        private:
+            friend TransferQueue;
+
+            void close()
+            {
+                std::exchange(this->staging_allocator, nullptr)->close(this->staging_allocation);
+            }
+
+            // Null once given back
+            util::RingAllocator*            staging_allocator = nullptr;
+            util::RingAllocator::Allocation staging_allocation {};
+            std::span<std::byte>            bytes;
+            vk::Buffer                      output_buffer;
+            u32                             output_offset = 0;
+        };
+
+        /// Polled by the caller of a streamed upload, complete once every piece has been copied on the gpu
+        class UploadToken
+        {
+        public:
+            UploadToken()  = default;
+            ~UploadToken() = default;
+
+            UploadToken(const UploadToken&)             = default;
+            UploadToken(UploadToken&&)                  = default;
+            UploadToken& operator= (const UploadToken&) = default;
+            UploadToken& operator= (UploadToken&&)      = default;
+
+            [[nodiscard]] bool isComplete() const
+            {
+                return this->complete == nullptr || this->complete->load(std::memory_order_acquire);
+            }
+
+        private:
+            friend TransferQueue;
+
+            std::shared_ptr<std::atomic<bool>> complete;
+        };
+
+        struct Flush
+        {
+            /// Grouped by buffer and sorted by output offset, none overlap. Valid until the next flush()
+            std::span<const Transfer>                       transfers;
+            /// Release up to here once the transfers have been copied. A flush whose mark is still waiting on open
+            /// reservations has no position, its space is released along with the next one that has
+            std::optional<util::RingAllocator::Position>    ring_position;
+            /// Set these once the transfers have been copied
+            std::vector<std::shared_ptr<std::atomic<bool>>> completed_uploads;
+        };
+
+    public:
+        /// stagingMemory must outlive the queue, its size must be a power of two
+        explicit TransferQueue(std::span<std::byte> stagingMemory);
+        ~TransferQueue() = default;
+
+        TransferQueue(const TransferQueue&)             = delete;
+        TransferQueue(TransferQueue&&)                  = delete;
+        TransferQueue& operator= (const TransferQueue&) = delete;
+        TransferQueue& operator= (TransferQueue&&)      = delete;
+
+        /// Transfers that are too large or don't fit in the staging memory right now fall back to being streamed.
+        /// So do ones that overlap a streamed upload that is still waiting, so they can't land before it
+        void enqueueByteTransfer(vk::Buffer, u32 offset, std::span<const std::byte>, std::source_location) const;
+        void enqueueByteTransfer(vk::Buffer, u32 offset, std::vector<std::byte>, std::source_location) const;
+
+        /// Uploads of any size, split into pieces and staged over as many flushes as there is room for.
+        /// Transfers enqueued after it that overlap it land after it, others aren't held back
+        [[nodiscard]] UploadToken
+        enqueueStreamedByteTransfer(vk::Buffer, u32 offset, std::vector<std::byte>, std::source_location) const;
+
+        /// Returns std::nullopt if the staging memory is out of space or the range overlaps a streamed upload that
+        /// is still waiting, fall back to enqueueByteTransfer in that case
+        [[nodiscard]] std::optional<Reservation>
+        reserveByteTransfer(vk::Buffer, u32 offset, u32 size, u32 alignment) const;
+        /// The reservation's contents are uploaded by the next flush
+        void commit(Reservation) const;
+        void cancel(Reservation) const;
+
+        /// Only one thread may flush and release
+        [[nodiscard]] Flush flush() const;
+        void                release(util::RingAllocator::Position) const;
+
+        [[nodiscard]] u64 getBytesInUse() const
+        {
+            return this->staging_allocator.getBytesInUse();
+        }
+        [[nodiscard]] u64 getCapacity() const
+        {
+            return this->staging_allocator.getCapacity();
+        }
+
+    private:
+        // Uploads too large for the staging memory, or that didn't fit when they were enqueued
+        struct StreamedUpload
+        {
+            vk::Buffer                         buffer;
+            u32                                offset;
+            std::vector<std::byte>             data;
+            usize                              bytes_staged;
+            std::shared_ptr<std::atomic<bool>> complete;
+            std::source_location               location;
+        };
+
+        struct StreamedPiece
+        {
+            Reservation      reservation;
+            const std::byte* source;
+        };
+
+        // Too large to stage directly, or overlaps a streamed upload that is still waiting
+        [[nodiscard]] bool                       mustStream(vk::Buffer, u32 offset, usize size) const;
+        [[nodiscard]] std::optional<Reservation> tryReserveBytes(vk::Buffer, u32 offset, u32 size, u32 alignment) const;
+        // Copies into the staging memory, returns false if it is out of space
+        [[nodiscard]] bool tryStageBytes(vk::Buffer, u32 offset, std::span<const std::byte>) const;
+        // Stages as many pieces as fit, in order. Returns the completion flags of the uploads that are now fully
+        // staged, they are done once this flush's transfers are
+        [[nodiscard]] std::vector<std::shared_ptr<std::atomic<bool>>> streamUploads() const;
+        // Stable, so transfers to the same buffer keep the order they were committed in
+        static void sortTransfersByBuffer(std::vector<Transfer>&, std::vector<Transfer>& scratch);
+        // Vulkan doesn't order the regions of a copy, so every byte written more than once in a flush is dropped
+        // from all but the newest transfer. Expects flush_transfers to be sorted by buffer
+        void trimOverwrittenBytes() const;
+
+        std::span<std::byte>                     staging_memory;
+        mutable util::RingAllocator              staging_allocator;
+        util::MpscQueue<Transfer>                transfers;
+        util::Mutex<std::vector<StreamedUpload>> streamed_uploads;
+        // The length of streamed_uploads, so enqueueing only takes the lock while something is being streamed
+        mutable std::atomic<u32>                 number_of_streamed_uploads;
+
+        // Only touched by flush(), kept so that their capacity is reused every flush
+        mutable std::vector<Transfer>      flush_transfers;
+        mutable std::vector<Transfer>      flush_sort_scratch;
+        mutable std::vector<u32>           flush_overlap_order;
+        mutable std::vector<u32>           flush_overlap_live;
+        mutable std::vector<StreamedPiece> flush_streamed_pieces;
+    };
+} // namespace gfx::core::vulkan
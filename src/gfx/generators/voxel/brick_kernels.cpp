@@ -0,0 +1,383 @@
+#include "brick_kernels.hpp"
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define CINNABAR_BRICK_KERNELS_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define CINNABAR_BRICK_KERNELS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define CINNABAR_BRICK_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace gfx::generators::voxel
+{
+    static_assert(sizeof(BooleanBrick) == 64);
+    static_assert(sizeof(MaterialBrick) == 1024);
+    static_assert(sizeof(CombinedBrick) == sizeof(BooleanBrick) + sizeof(MaterialBrick));
+
+    std::string_view getBrickKernelInstructionSet()
+    {
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        return "AVX2";
+#elif defined(CINNABAR_BRICK_KERNELS_SSE2)
+        return "SSE2";
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        return "NEON";
+#else
+        return "Scalar";
+#endif
+    }
+
+    BooleanBrickCompactResult isBooleanBrickCompact(const BooleanBrick& brick)
+    {
+        const auto* const bytes = reinterpret_cast<const std::byte*>(brick.data);
+
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + 32));
+
+        const __m256i anySet = _mm256_or_si256(lo, hi);
+        const __m256i allSet = _mm256_and_si256(lo, hi);
+
+        if (_mm256_testz_si256(anySet, anySet) != 0)
+        {
+            return BooleanBrickCompactResult(true, false);
+        }
+
+        if (_mm256_testc_si256(allSet, _mm256_set1_epi32(-1)) != 0)
+        {
+            return BooleanBrickCompactResult(true, true);
+        }
+
+        return BooleanBrickCompactResult(false, false);
+#elif defined(CINNABAR_BRICK_KERNELS_SSE2)
+        __m128i anySet = _mm_setzero_si128();
+        __m128i allSet = _mm_set1_epi32(-1);
+
+        for (usize i = 0; i < 4; ++i)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + (i * 16)));
+
+            anySet = _mm_or_si128(anySet, v);
+            allSet = _mm_and_si128(allSet, v);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(anySet, _mm_setzero_si128())) == 0xFFFF)
+        {
+            return BooleanBrickCompactResult(true, false);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(allSet, _mm_set1_epi32(-1))) == 0xFFFF)
+        {
+            return BooleanBrickCompactResult(true, true);
+        }
+
+        return BooleanBrickCompactResult(false, false);
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        uint32x4_t anySet = vdupq_n_u32(0);
+        uint32x4_t allSet = vdupq_n_u32(~0u);
+
+        for (usize i = 0; i < 4; ++i)
+        {
+            const uint32x4_t v = vld1q_u32(brick.data + (i * 4));
+
+            anySet = vorrq_u32(anySet, v);
+            allSet = vandq_u32(allSet, v);
+        }
+
+        if (vmaxvq_u32(anySet) == 0)
+        {
+            return BooleanBrickCompactResult(true, false);
+        }
+
+        if (vminvq_u32(allSet) == ~0u)
+        {
+            return BooleanBrickCompactResult(true, true);
+        }
+
+        return BooleanBrickCompactResult(false, false);
+#else
+        u32 anySet = 0;
+        u32 allSet = ~0u;
+
+        for (u32 w : brick.data)
+        {
+            anySet |= w;
+            allSet &= w;
+        }
+
+        if (anySet == 0)
+        {
+            return BooleanBrickCompactResult(true, false);
+        }
+
+        if (allSet == ~0u)
+        {
+            return BooleanBrickCompactResult(true, true);
+        }
+
+        return BooleanBrickCompactResult(false, false);
+#endif
+    }
+
+    MaterialBrickCompactResult isMaterialBrickCompact(const MaterialBrick& brick)
+    {
+        const u16         compare = brick.data[0][0][0];
+        const auto* const bytes   = reinterpret_cast<const std::byte*>(brick.data);
+
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        const __m256i splat = _mm256_set1_epi16(static_cast<i16>(compare));
+
+        // Check a quarter at a time so mixed bricks (the common case) bail out early
+        for (usize quarter = 0; quarter < 4; ++quarter)
+        {
+            __m256i difference = _mm256_setzero_si256();
+
+            for (usize i = 0; i < 8; ++i)
+            {
+                const __m256i v =
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + (quarter * 256) + (i * 32)));
+
+                difference = _mm256_or_si256(difference, _mm256_xor_si256(v, splat));
+            }
+
+            if (_mm256_testz_si256(difference, difference) == 0)
+            {
+                return MaterialBrickCompactResult(false, 0);
+            }
+        }
+#elif defined(CINNABAR_BRICK_KERNELS_SSE2)
+        const __m128i splat = _mm_set1_epi16(static_cast<i16>(compare));
+
+        for (usize quarter = 0; quarter < 4; ++quarter)
+        {
+            __m128i difference = _mm_setzero_si128();
+
+            for (usize i = 0; i < 16; ++i)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + (quarter * 256) + (i * 16)));
+
+                difference = _mm_or_si128(difference, _mm_xor_si128(v, splat));
+            }
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) != 0xFFFF)
+            {
+                return MaterialBrickCompactResult(false, 0);
+            }
+        }
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        const uint16x8_t splat = vdupq_n_u16(compare);
+        const u16* const words = &brick.data[0][0][0];
+
+        for (usize quarter = 0; quarter < 4; ++quarter)
+        {
+            uint16x8_t difference = vdupq_n_u16(0);
+
+            for (usize i = 0; i < 16; ++i)
+            {
+                const uint16x8_t v = vld1q_u16(words + (quarter * 128) + (i * 8));
+
+                difference = vorrq_u16(difference, veorq_u16(v, splat));
+            }
+
+            if (vmaxvq_u16(difference) != 0)
+            {
+                return MaterialBrickCompactResult(false, 0);
+            }
+        }
+#else
+        const u16* const words = &brick.data[0][0][0];
+
+        for (usize i = 0; i < 512; ++i)
+        {
+            if (words[i] != compare)
+            {
+                return MaterialBrickCompactResult(false, 0);
+            }
+        }
+#endif
+        static_cast<void>(bytes);
+
+        return MaterialBrickCompactResult(true, compare);
+    }
+
+    CombinedBrickReadResult isCombinedBrickCompact(const CombinedBrick& brick)
+    {
+        if (!isBooleanBrickCompact(brick.boolean_brick).is_compact)
+        {
+            return CombinedBrickReadResult(0, false);
+        }
+
+        const MaterialBrickCompactResult materialCompact = isMaterialBrickCompact(brick.material_brick);
+
+        if (materialCompact.is_compact)
+        {
+            return CombinedBrickReadResult(materialCompact.voxel, true);
+        }
+
+        return CombinedBrickReadResult(0, false);
+    }
+
+    void fillCombinedBrick(CombinedBrick& brick, u16 voxel)
+    {
+        const u32   booleanWord = voxel != 0 ? ~0u : 0u;
+        auto* const booleans    = reinterpret_cast<std::byte*>(brick.boolean_brick.data);
+        auto* const materials   = reinterpret_cast<std::byte*>(brick.material_brick.data);
+
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        const __m256i booleanSplat  = _mm256_set1_epi32(static_cast<i32>(booleanWord));
+        const __m256i materialSplat = _mm256_set1_epi16(static_cast<i16>(voxel));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(booleans), booleanSplat);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(booleans + 32), booleanSplat);
+
+        for (usize i = 0; i < 32; ++i)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(materials + (i * 32)), materialSplat);
+        }
+#elif defined(CINNABAR_BRICK_KERNELS_SSE2)
+        const __m128i booleanSplat  = _mm_set1_epi32(static_cast<i32>(booleanWord));
+        const __m128i materialSplat = _mm_set1_epi16(static_cast<i16>(voxel));
+
+        for (usize i = 0; i < 4; ++i)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(booleans + (i * 16)), booleanSplat);
+        }
+
+        for (usize i = 0; i < 64; ++i)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(materials + (i * 16)), materialSplat);
+        }
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        const uint32x4_t booleanSplat  = vdupq_n_u32(booleanWord);
+        const uint16x8_t materialSplat = vdupq_n_u16(voxel);
+        u16* const       words         = &brick.material_brick.data[0][0][0];
+
+        for (usize i = 0; i < 4; ++i)
+        {
+            vst1q_u32(brick.boolean_brick.data + (i * 4), booleanSplat);
+        }
+
+        for (usize i = 0; i < 64; ++i)
+        {
+            vst1q_u16(words + (i * 8), materialSplat);
+        }
+#else
+        u16* const words = &brick.material_brick.data[0][0][0];
+
+        for (u32& w : brick.boolean_brick.data)
+        {
+            w = booleanWord;
+        }
+
+        for (usize i = 0; i < 512; ++i)
+        {
+            words[i] = voxel;
+        }
+#endif
+        static_cast<void>(booleans);
+        static_cast<void>(materials);
+    }
+
+    u32 countSolidVoxels(const BooleanBrick& brick)
+    {
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        // Nibble lookup popcount, then sum the bytes with sad
+        const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+        const auto*   bytes      = reinterpret_cast<const std::byte*>(brick.data);
+
+        __m256i sums = _mm256_setzero_si256();
+
+        for (usize i = 0; i < 2; ++i)
+        {
+            const __m256i v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + (i * 32)));
+            const __m256i low  = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, lowNibbles));
+            const __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibbles));
+
+            sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+        }
+
+        return static_cast<u32>(
+            _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2)
+            + _mm256_extract_epi64(sums, 3));
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        u32 count = 0;
+
+        for (usize i = 0; i < 4; ++i)
+        {
+            const uint8x16_t v = vreinterpretq_u8_u32(vld1q_u32(brick.data + (i * 4)));
+
+            count += vaddvq_u8(vcntq_u8(v));
+        }
+
+        return count;
+#else
+        // SSE2 has no byte shuffle, std::popcount becomes popcnt wherever the target has it
+        std::array<u64, 8> words {};
+        std::memcpy(words.data(), brick.data, sizeof(BooleanBrick));
+
+        u32 count = 0;
+
+        for (u64 w : words)
+        {
+            count += static_cast<u32>(std::popcount(w));
+        }
+
+        return count;
+#endif
+    }
+
+    bool areCombinedBricksEqual(const CombinedBrick& l, const CombinedBrick& r)
+    {
+        const auto* const lBytes = reinterpret_cast<const std::byte*>(&l);
+        const auto* const rBytes = reinterpret_cast<const std::byte*>(&r);
+
+#if defined(CINNABAR_BRICK_KERNELS_AVX2)
+        static_assert(sizeof(CombinedBrick) % 32 == 0);
+
+        __m256i difference = _mm256_setzero_si256();
+
+        for (usize i = 0; i < sizeof(CombinedBrick); i += 32)
+        {
+            const __m256i lV = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lBytes + i));
+            const __m256i rV = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rBytes + i));
+
+            difference = _mm256_or_si256(difference, _mm256_xor_si256(lV, rV));
+        }
+
+        return _mm256_testz_si256(difference, difference) != 0;
+#elif defined(CINNABAR_BRICK_KERNELS_SSE2)
+        __m128i difference = _mm_setzero_si128();
+
+        for (usize i = 0; i < sizeof(CombinedBrick); i += 16)
+        {
+            const __m128i lV = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lBytes + i));
+            const __m128i rV = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rBytes + i));
+
+            difference = _mm_or_si128(difference, _mm_xor_si128(lV, rV));
+        }
+
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) == 0xFFFF;
+#elif defined(CINNABAR_BRICK_KERNELS_NEON)
+        uint8x16_t difference = vdupq_n_u8(0);
+
+        for (usize i = 0; i < sizeof(CombinedBrick); i += 16)
+        {
+            const uint8x16_t lV = vld1q_u8(reinterpret_cast<const u8*>(lBytes + i));
+            const uint8x16_t rV = vld1q_u8(reinterpret_cast<const u8*>(rBytes + i));
+
+            difference = vorrq_u8(difference, veorq_u8(lV, rV));
+        }
+
+        return vmaxvq_u8(difference) == 0;
+#else
+        return std::memcmp(lBytes, rBytes, sizeof(CombinedBrick)) == 0;
+#endif
+    }
+} // namespace gfx::generators::voxel
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/util.hpp"
+#include <string_view>
+
+namespace gfx::generators::voxel
+{
+    /// Vectorised versions of the brick helpers in shared_data_structures.slang for use on the cpu.
+    /// The instruction set is chosen at compile time, AVX2 if the compiler is allowed to emit it, otherwise SSE2
+    /// on x86-64 or NEON on arm64, with a scalar fallback for everything else.
+
+    [[nodiscard]] std::string_view getBrickKernelInstructionSet();
+
+    /// Unlike BooleanBrick::isCompact, a brick is only compact if every voxel is solid or every voxel is empty
+    [[nodiscard]] BooleanBrickCompactResult  isBooleanBrickCompact(const BooleanBrick&);
+    [[nodiscard]] MaterialBrickCompactResult isMaterialBrickCompact(const MaterialBrick&);
+    [[nodiscard]] CombinedBrickReadResult    isCombinedBrickCompact(const CombinedBrick&);
+
+    void fillCombinedBrick(CombinedBrick&, u16 voxel);
+
+    [[nodiscard]] u32  countSolidVoxels(const BooleanBrick&);
+    [[nodiscard]] bool areCombinedBricksEqual(const CombinedBrick&, const CombinedBrick&);
+} // namespace gfx::generators::voxel
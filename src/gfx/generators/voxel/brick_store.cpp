@@ -0,0 +1,371 @@
+#include "brick_store.hpp"
+#include "gfx/core/renderer.hpp"
+#include "gfx/generators/voxel/brick_kernels.hpp"
+#include "gfx/shader_common/bindings.slang"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <tracy/Tracy.hpp>
+
+namespace gfx::generators::voxel
+{
+    BrickStore::BrickStore(const core::Renderer* renderer_, u32 maxBricks, u32 maxWords, bool deduplicate_)
+        : renderer {renderer_}
+        , deduplicate {deduplicate_}
+        , allocator {maxBricks}
+        , word_allocator {maxWords, maxBricks}
+        , total_references {0}
+        , resident_words {0}
+        , palette_bricks {
+              this->renderer,
+              vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              maxWords,
+              "Palette Bricks",
+              SBO_PALETTE_BRICKS}
+    {}
+
+    BrickStore::~BrickStore()
+    {
+        for (Slot& slot : this->slots)
+        {
+            if (!slot.words.isNull())
+            {
+                this->word_allocator.free(std::move(slot.words));
+            }
+        }
+    }
+
+    BrickStore::BrickId BrickStore::insert(const CombinedBrick& brick)
+    {
+        const u64 hash = this->deduplicate ? BrickStore::hashBrick(brick) : 0;
+
+        this->total_references += 1;
+
+        if (this->deduplicate)
+        {
+            if (const BrickId existing = this->findResident(hash, brick); existing != NullBrickId)
+            {
+                this->slots[existing].references += 1;
+
+                return existing;
+            }
+        }
+
+        const BrickId newId = this->allocator.allocateOrPanic();
+
+        if (newId >= this->slots.size())
+        {
+            this->slots.resize(newId + 1);
+            this->resident_bricks.resize(newId + 1);
+        }
+
+        this->slots[newId].hash       = hash;
+        this->slots[newId].references = 1;
+        this->store(newId, brick);
+
+        if (this->deduplicate)
+        {
+            this->link(newId, hash);
+        }
+
+        return newId;
+    }
+
+    void BrickStore::release(BrickId id)
+    {
+        Slot& slot = this->slots[id];
+
+        assert::critical(slot.references > 0, "Released brick {} with no references", id);
+
+        slot.references -= 1;
+        this->total_references -= 1;
+
+        if (slot.references == 0)
+        {
+            if (this->deduplicate)
+            {
+                this->unlink(id);
+            }
+
+            this->freeSlot(id);
+        }
+    }
+
+    BrickStore::BrickId BrickStore::replace(BrickId id, const CombinedBrick& brick)
+    {
+        if (id == NullBrickId)
+        {
+            return this->insert(brick);
+        }
+
+        if (this->slots[id].references > 1)
+        {
+            // shared, copy on write
+            this->release(id);
+
+            return this->insert(brick);
+        }
+
+        const u64 hash = this->deduplicate ? BrickStore::hashBrick(brick) : 0;
+
+        if (this->deduplicate)
+        {
+            this->unlink(id);
+
+            // The edit made this brick identical to one that's already resident, just share that
+            if (const BrickId existing = this->findResident(hash, brick); existing != NullBrickId)
+            {
+                this->slots[existing].references += 1;
+                this->slots[id].references = 0;
+                this->freeSlot(id);
+
+                return existing;
+            }
+
+            this->link(id, hash);
+        }
+
+        this->slots[id].hash = hash;
+        this->store(id, brick);
+
+        return id;
+    }
+
+    const CombinedBrick& BrickStore::read(BrickId id) const
+    {
+        return this->resident_bricks[id];
+    }
+
+    u32 BrickStore::getGpuPointer(BrickId id) const
+    {
+        if (id == NullBrickId)
+        {
+            return ~0u;
+        }
+
+        return util::RangeAllocator::getOffsetofAllocation(this->slots[id].words);
+    }
+
+    u32 BrickStore::getNumberOfResidentBricks() const
+    {
+        return this->allocator.getNumberAllocated();
+    }
+
+    u32 BrickStore::getNumberOfReferences() const
+    {
+        return this->total_references;
+    }
+
+    u32 BrickStore::getNumberOfResidentWords() const
+    {
+        return this->resident_words;
+    }
+
+    void BrickStore::flushViaStager(const core::vulkan::BufferStager& stager, std::pmr::memory_resource* resource)
+    {
+        ZoneScoped;
+
+        // A brick stored more than once since the last flush only uploads its latest contents
+        std::ranges::sort(
+            this->pending_uploads,
+            [](const PendingUpload& l, const PendingUpload& r)
+            {
+                return l.id != r.id ? l.id < r.id : l.palette_index > r.palette_index;
+            });
+        const auto [duplicatesBegin, duplicatesEnd] =
+            std::ranges::unique(this->pending_uploads, {}, &PendingUpload::id);
+        this->pending_uploads.erase(duplicatesBegin, duplicatesEnd);
+
+        // Anything released since it was written doesn't need to go up
+        std::erase_if(
+            this->pending_uploads,
+            [this](const PendingUpload& u)
+            {
+                return this->slots[u.id].references == 0;
+            });
+
+        std::ranges::sort(
+            this->pending_uploads,
+            {},
+            [this](const PendingUpload& u)
+            {
+                return this->getGpuPointer(u.id);
+            });
+
+        std::pmr::vector<u32> wordCounts {resource};
+        wordCounts.reserve(this->pending_uploads.size());
+
+        for (const PendingUpload& u : this->pending_uploads)
+        {
+            wordCounts.push_back(this->pending_palettes[u.palette_index].getHeader().getWordCount());
+        }
+
+        // Bricks that ended up next to each other in the word buffer are uploaded together, encoded straight into
+        // staging memory whenever the stager has room for the run
+        const auto uploadRun = [&](usize firstUpload, usize lastUpload, u32 runStart, u32 runWords)
+        {
+            std::optional<core::vulkan::BufferStager::Reservation> maybeReservation =
+                stager.reserveTransfer(this->palette_bricks, runStart, runWords);
+            std::pmr::vector<u32> fallbackWords {resource};
+            std::span<u32>        output {};
+
+            if (maybeReservation.has_value())
+            {
+                output = maybeReservation->getData<u32>();
+            }
+            else
+            {
+                fallbackWords.resize(runWords);
+                output = fallbackWords;
+            }
+
+            u32 written = 0;
+
+            for (usize i = firstUpload; i < lastUpload; ++i)
+            {
+                const PendingUpload& upload = this->pending_uploads[i];
+
+                encodePaletteBrick(
+                    this->resident_bricks[upload.id],
+                    this->pending_palettes[upload.palette_index],
+                    output.subspan(written, wordCounts[i]));
+
+                written += wordCounts[i];
+            }
+
+            if (maybeReservation.has_value())
+            {
+                stager.commit(std::move(*maybeReservation));
+            }
+            else
+            {
+                stager.enqueueTransfer(this->palette_bricks, runStart, std::span<const u32> {fallbackWords});
+            }
+        };
+
+        usize runBegin = 0;
+        u32   runStart = 0;
+        u32   runWords = 0;
+
+        for (usize i = 0; i < this->pending_uploads.size(); ++i)
+        {
+            const u32 gpuPointer = this->getGpuPointer(this->pending_uploads[i].id);
+
+            if (i != runBegin && runStart + runWords != gpuPointer)
+            {
+                uploadRun(runBegin, i, runStart, runWords);
+
+                runBegin = i;
+                runWords = 0;
+            }
+
+            if (i == runBegin)
+            {
+                runStart = gpuPointer;
+            }
+
+            runWords += wordCounts[i];
+        }
+
+        if (runBegin < this->pending_uploads.size())
+        {
+            uploadRun(runBegin, this->pending_uploads.size(), runStart, runWords);
+        }
+
+        this->pending_uploads.clear();
+        this->pending_palettes.clear();
+    }
+
+    u64 BrickStore::hashBrick(const CombinedBrick& brick)
+    {
+        static_assert(sizeof(CombinedBrick) % sizeof(u64) == 0);
+
+        std::array<u64, sizeof(CombinedBrick) / sizeof(u64)> words {};
+        std::memcpy(words.data(), &brick, sizeof(CombinedBrick));
+
+        u64 hash = 14695981039346656037ULL;
+
+        for (u64 w : words)
+        {
+            hash = util::hashCombine(hash, w);
+        }
+
+        return hash;
+    }
+
+    BrickStore::BrickId BrickStore::findResident(u64 hash, const CombinedBrick& brick) const
+    {
+        const auto it = this->lookup.find(hash);
+
+        if (it == this->lookup.end())
+        {
+            return NullBrickId;
+        }
+
+        // Collisions are possible, so the bytes have to be checked
+        for (BrickId candidate : it->second)
+        {
+            if (areCombinedBricksEqual(this->resident_bricks[candidate], brick))
+            {
+                return candidate;
+            }
+        }
+
+        return NullBrickId;
+    }
+
+    void BrickStore::link(BrickId id, u64 hash)
+    {
+        this->lookup[hash].push_back(id);
+    }
+
+    void BrickStore::unlink(BrickId id)
+    {
+        const auto it = this->lookup.find(this->slots[id].hash);
+
+        assert::critical(it != this->lookup.end(), "Brick {} was not linked", id);
+
+        std::erase(it->second, id);
+
+        if (it->second.empty())
+        {
+            this->lookup.erase(it);
+        }
+    }
+
+    void BrickStore::freeSlot(BrickId id)
+    {
+        Slot& slot = this->slots[id];
+
+        this->resident_words -= this->word_allocator.getSizeOfAllocation(slot.words);
+        this->word_allocator.free(std::move(slot.words));
+        this->allocator.free(id);
+    }
+
+    void BrickStore::store(BrickId id, const CombinedBrick& brick)
+    {
+        Slot&               slot        = this->slots[id];
+        const BrickPalette& palette     = this->pending_palettes.emplace_back(buildBrickPalette(brick));
+        const u32           neededWords = palette.getHeader().getWordCount();
+
+        // A brick that shrank keeps its old words, one that grew has to move
+        if (!slot.words.isNull() && this->word_allocator.getSizeOfAllocation(slot.words) < neededWords)
+        {
+            this->resident_words -= this->word_allocator.getSizeOfAllocation(slot.words);
+            this->word_allocator.free(std::move(slot.words));
+        }
+
+        if (slot.words.isNull())
+        {
+            slot.words = this->word_allocator.allocate(neededWords);
+            this->resident_words += this->word_allocator.getSizeOfAllocation(slot.words);
+        }
+
+        this->resident_bricks[id] = brick;
+        this->pending_uploads.push_back(
+            PendingUpload {.id {id}, .palette_index {static_cast<u32>(this->pending_palettes.size() - 1)}});
+    }
+} // namespace gfx::generators::voxel
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "gfx/core/vulkan/buffer.hpp"
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/palette_brick.hpp"
+#include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/allocators/index_allocator.hpp"
+#include "util/allocators/range_allocator.hpp"
+#include "util/util.hpp"
+#include <boost/container/small_vector.hpp>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+namespace gfx::core
+{
+    class Renderer;
+} // namespace gfx::core
+
+namespace gfx::generators::voxel
+{
+    /// Owns the physical brick storage on the gpu, bricks are stored palette compressed in SBO_PALETTE_BRICKS.
+    /// When deduplicating, byte identical bricks share a single reference counted slot. Shared slots are never
+    /// written in place, editing one goes through replace(), which copies on write.
+    class BrickStore
+    {
+    public:
+        using BrickId                        = u32;
+        static constexpr BrickId NullBrickId = ~0u;
+    public:
+        BrickStore(const core::Renderer*, u32 maxBricks, u32 maxWords, bool deduplicate);
+        ~BrickStore();
+
+        BrickStore(const BrickStore&)             = delete;
+        BrickStore(BrickStore&&)                  = delete;
+        BrickStore& operator= (const BrickStore&) = delete;
+        BrickStore& operator= (BrickStore&&)      = delete;
+
+        /// Returns a slot holding this brick, either an existing identical one or a freshly allocated one
+        [[nodiscard]] BrickId insert(const CombinedBrick&);
+        /// Drops a reference, the slot is freed once nothing references it
+        void                  release(BrickId);
+        /// Same as release() followed by insert(), except that a slot nothing else references is rewritten in place
+        /// The id is kept in that case, but the brick may still have moved, so check getGpuPointer() again
+        [[nodiscard]] BrickId replace(BrickId, const CombinedBrick&);
+
+        [[nodiscard]] const CombinedBrick& read(BrickId) const;
+        /// What should be written into a brick pointer table for this brick, ~0u for NullBrickId
+        [[nodiscard]] u32                  getGpuPointer(BrickId) const;
+
+        [[nodiscard]] u32 getNumberOfResidentBricks() const;
+        [[nodiscard]] u32 getNumberOfReferences() const;
+        [[nodiscard]] u32 getNumberOfResidentWords() const;
+
+        // resource is used for scratch space while encoding the uploads
+        void flushViaStager(
+            const core::vulkan::BufferStager&, std::pmr::memory_resource* = std::pmr::get_default_resource());
+
+    private:
+        struct Slot
+        {
+            u64                   hash;
+            u32                   references;
+            util::RangeAllocation words;
+        };
+
+        struct PendingUpload
+        {
+            BrickId id;
+            // Into pending_palettes, built when the brick was stored and reused to encode it
+            u32     palette_index;
+        };
+
+        [[nodiscard]] static u64 hashBrick(const CombinedBrick&);
+
+        [[nodiscard]] BrickId findResident(u64 hash, const CombinedBrick&) const;
+        void                  link(BrickId, u64 hash);
+        void                  unlink(BrickId);
+        void                  store(BrickId, const CombinedBrick&);
+        void                  freeSlot(BrickId);
+
+        const core::Renderer* renderer;
+        bool                  deduplicate;
+
+        util::IndexAllocator                                                 allocator;
+        util::RangeAllocator                                                 word_allocator;
+        std::vector<Slot>                                                    slots;
+        std::vector<CombinedBrick>                                           resident_bricks;
+        std::unordered_map<u64, boost::container::small_vector<BrickId, 1>> lookup;
+        u32                                                                  total_references;
+        u32                                                                  resident_words;
+        std::vector<PendingUpload>                                           pending_uploads;
+        std::vector<BrickPalette>                                            pending_palettes;
+
+        gfx::core::vulkan::GpuOnlyBuffer<u32> palette_bricks;
+    };
+} // namespace gfx::generators::voxel
@@ -0,0 +1,167 @@
+#include "chunk_generation_service.hpp"
+#include "gfx/generators/voxel/generator.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <glm/geometric.hpp>
+#include <tracy/Tracy.hpp>
+
+namespace gfx::generators::voxel
+{
+    ChunkGenerationService::ChunkGenerationService(const WorldGenerator* generator_, u32 numberOfWorkers)
+        : generator {generator_}
+        , priority_origin {0.0f, 0.0f, 0.0f}
+        , next_request_id {0}
+    {
+        if (numberOfWorkers == 0)
+        {
+            numberOfWorkers = std::max(1u, std::thread::hardware_concurrency() - 1);
+        }
+
+        this->workers.reserve(numberOfWorkers);
+
+        for (u32 i = 0; i < numberOfWorkers; ++i)
+        {
+            this->workers.emplace_back(
+                [this](const std::stop_token& stopToken)
+                {
+                    this->workerLoop(stopToken);
+                });
+        }
+    }
+
+    ChunkGenerationService::~ChunkGenerationService()
+    {
+        for (std::jthread& w : this->workers)
+        {
+            w.request_stop();
+        }
+
+        this->work_available.notify_all();
+
+        // join before the pending promises are destroyed
+        this->workers.clear();
+
+        for (PendingRequest& r : this->pending)
+        {
+            r.promise.set_value(std::nullopt);
+        }
+    }
+
+    ChunkGenerationService::Request ChunkGenerationService::enqueue(ChunkLocation location)
+    {
+        std::promise<std::optional<GeneratedChunk>> promise {};
+        std::future<std::optional<GeneratedChunk>>  future = promise.get_future();
+
+        RequestId id {};
+
+        {
+            std::unique_lock lock {this->mutex};
+
+            id = this->next_request_id++;
+
+            this->pending.push_back(PendingRequest {
+                .id {id},
+                .location {location},
+                .priority {this->getPriorityOfLocation(location)},
+                .promise {std::move(promise)},
+            });
+
+            std::ranges::push_heap(this->pending, PendingRequest::Compare {});
+        }
+
+        this->work_available.notify_one();
+
+        return Request {.id {id}, .future {std::move(future)}};
+    }
+
+    bool ChunkGenerationService::cancel(RequestId id)
+    {
+        std::unique_lock lock {this->mutex};
+
+        const auto it = std::ranges::find(this->pending, id, &PendingRequest::id);
+
+        if (it == this->pending.end())
+        {
+            return false;
+        }
+
+        it->promise.set_value(std::nullopt);
+        this->pending.erase(it);
+
+        std::ranges::make_heap(this->pending, PendingRequest::Compare {});
+
+        return true;
+    }
+
+    void ChunkGenerationService::setPriorityOrigin(glm::vec3 newOrigin)
+    {
+        std::unique_lock lock {this->mutex};
+
+        this->priority_origin = newOrigin;
+
+        for (PendingRequest& r : this->pending)
+        {
+            r.priority = this->getPriorityOfLocation(r.location);
+        }
+
+        std::ranges::make_heap(this->pending, PendingRequest::Compare {});
+    }
+
+    usize ChunkGenerationService::getNumberOfPendingRequests() const
+    {
+        std::unique_lock lock {this->mutex};
+
+        return this->pending.size();
+    }
+
+    f32 ChunkGenerationService::getPriorityOfLocation(ChunkLocation location) const
+    {
+        const f32 halfWidth = static_cast<f32>(location.getChunkWidthUnits()) / 2.0f;
+
+        const glm::vec3 center = static_cast<glm::vec3>(location.getChunkNegativeCornerLocation()) + halfWidth;
+
+        return glm::distance(center, this->priority_origin);
+    }
+
+    void ChunkGenerationService::workerLoop(const std::stop_token& stopToken)
+    {
+        while (!stopToken.stop_requested())
+        {
+            std::optional<PendingRequest> maybeRequest {};
+
+            {
+                std::unique_lock lock {this->mutex};
+
+                const bool hasWork = this->work_available.wait(
+                    lock,
+                    stopToken,
+                    [this]
+                    {
+                        return !this->pending.empty();
+                    });
+
+                if (!hasWork)
+                {
+                    return;
+                }
+
+                std::ranges::pop_heap(this->pending, PendingRequest::Compare {});
+                maybeRequest.emplace(std::move(this->pending.back()));
+                this->pending.pop_back();
+            }
+
+            ZoneScopedN("ChunkGenerationService::generate");
+
+            try
+            {
+                maybeRequest->promise.set_value(this->generator->generateChunkPreDense(maybeRequest->location));
+            }
+            catch (...)
+            {
+                log::error("Chunk generation request {} failed", maybeRequest->id);
+
+                maybeRequest->promise.set_exception(std::current_exception());
+            }
+        }
+    }
+} // namespace gfx::generators::voxel
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/generator.hpp"
+#include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/util.hpp"
+#include <condition_variable>
+#include <future>
+#include <glm/vec3.hpp>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace gfx::generators::voxel
+{
+    /// Runs WorldGenerator::generateChunkPreDense on a pool of worker threads.
+    /// Pending requests are serviced closest-first to the current priority origin (usually the camera).
+    class ChunkGenerationService
+    {
+    public:
+        using RequestId = u64;
+
+        struct Request
+        {
+            RequestId id;
+            // Resolves to std::nullopt if the request was cancelled before a worker picked it up
+            std::future<std::optional<GeneratedChunk>> future;
+        };
+
+    public:
+        // numberOfWorkers == 0 will use all but one of the hardware threads
+        explicit ChunkGenerationService(const WorldGenerator*, u32 numberOfWorkers = 0);
+        ~ChunkGenerationService();
+
+        ChunkGenerationService(const ChunkGenerationService&)             = delete;
+        ChunkGenerationService(ChunkGenerationService&&)                  = delete;
+        ChunkGenerationService& operator= (const ChunkGenerationService&) = delete;
+        ChunkGenerationService& operator= (ChunkGenerationService&&)      = delete;
+
+        [[nodiscard]] Request enqueue(ChunkLocation);
+
+        /// Returns true if the request was still pending and has been cancelled
+        /// Requests that are already being generated can not be cancelled
+        bool cancel(RequestId);
+        /// Cancels every pending request whose location satisfies the predicate, returns the number cancelled
+        usize cancelIf(std::invocable<ChunkLocation> auto shouldCancel)
+        {
+            std::unique_lock lock {this->mutex};
+
+            const usize oldSize = this->pending.size();
+
+            std::erase_if(
+                this->pending,
+                [&](PendingRequest& r)
+                {
+                    if (shouldCancel(r.location))
+                    {
+                        r.promise.set_value(std::nullopt);
+
+                        return true;
+                    }
+
+                    return false;
+                });
+
+            std::ranges::make_heap(this->pending, PendingRequest::Compare {});
+
+            return oldSize - this->pending.size();
+        }
+
+        void setPriorityOrigin(glm::vec3);
+
+        [[nodiscard]] usize getNumberOfPendingRequests() const;
+
+    private:
+        struct PendingRequest
+        {
+            RequestId                                   id;
+            ChunkLocation                               location;
+            f32                                         priority;
+            std::promise<std::optional<GeneratedChunk>> promise;
+
+            // std::ranges heaps are max heaps, so the furthest chunk must compare as the smallest
+            struct Compare
+            {
+                bool operator() (const PendingRequest& l, const PendingRequest& r) const
+                {
+                    return l.priority > r.priority;
+                }
+            };
+        };
+
+        [[nodiscard]] f32 getPriorityOfLocation(ChunkLocation) const;
+        void              workerLoop(const std::stop_token&);
+
+        const WorldGenerator* generator;
+
+        mutable std::mutex          mutex;
+        std::condition_variable_any work_available;
+        std::vector<PendingRequest> pending;
+        glm::vec3                   priority_origin;
+        RequestId                   next_request_id;
+        std::vector<std::jthread>   workers;
+    };
+} // namespace gfx::generators::voxel
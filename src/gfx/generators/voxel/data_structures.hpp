@@ -5,8 +5,11 @@
 #include "util/allocators/range_allocator.hpp"
 #include "util/logger.hpp"
 #include "util/util.hpp"
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <boost/container/flat_set.hpp>
+#include <glm/common.hpp>
 #include <glm/ext/vector_uint3_sized.hpp>
 #include <glm/fwd.hpp>
 #include <glm/geometric.hpp>
@@ -14,6 +17,8 @@
 #include <glm/vec4.hpp>
 #include <limits>
 #include <optional>
+#include <span>
+#include <vector>
 
 namespace gfx::generators::voxel
 {
@@ -204,11 +209,202 @@ namespace gfx::generators::voxel
         bool operator== (const EmissiveVoxelUpdateChange&) const = default;
     };
 
+    /// Which parts of a chunk contain solid voxels, so empty space can be skipped with bit scans rather than by
+    /// walking the BrickMap and every BooleanBrick
+    struct ChunkOccupancy
+    {
+        // Bit (64 * x) + (8 * y) + z is set if that brick has any solid voxel, the same order as BrickMap
+        std::array<u64, 8>  brick_mask {};
+        // Bit ox + (2 * oy) + (4 * oz) is set if that 4x4x4 octant of the brick has any solid voxel
+        std::array<u8, 512> brick_octants {};
+
+        [[nodiscard]] static u8 getOctantsOfBrick(const BooleanBrick& brick)
+        {
+            // Each word of a BooleanBrick is 4 rows of 8 voxels in x, with a constant z and oy
+            static constexpr u32 LowXMask  = 0x0F0F0F0Fu;
+            static constexpr u32 HighXMask = 0xF0F0F0F0u;
+
+            u8 octants = 0;
+
+            for (u32 w = 0; w < 16; ++w)
+            {
+                const u32 oy = w % 2;
+                const u32 oz = w / 8;
+
+                if ((brick.data[w] & LowXMask) != 0)
+                {
+                    octants |= static_cast<u8>(1u << ((2 * oy) + (4 * oz)));
+                }
+
+                if ((brick.data[w] & HighXMask) != 0)
+                {
+                    octants |= static_cast<u8>(1u << (1 + (2 * oy) + (4 * oz)));
+                }
+            }
+
+            return octants;
+        }
+
+        [[nodiscard]] static ChunkOccupancy fromBrickMap(const BrickMap& brickMap, std::span<const CombinedBrick> bricks)
+        {
+            ChunkOccupancy occupancy {};
+
+            for (u8 bCX = 0; bCX < 8; ++bCX)
+            {
+                for (u8 bCY = 0; bCY < 8; ++bCY)
+                {
+                    for (u8 bCZ = 0; bCZ < 8; ++bCZ)
+                    {
+                        const MaybeBrickOffsetOrMaterialId maybeBrickOffset = brickMap[bCX][bCY][bCZ];
+                        const BrickCoordinate              bC {glm::u8vec3 {bCX, bCY, bCZ}, UncheckedInDebugTag {}};
+
+                        if (maybeBrickOffset.isMaterial())
+                        {
+                            occupancy.setBrickFromMaterial(bC, maybeBrickOffset.getMaterial());
+                        }
+                        else
+                        {
+                            occupancy.setBrick(bC, getOctantsOfBrick(bricks[maybeBrickOffset._data].boolean_brick));
+                        }
+                    }
+                }
+            }
+
+            return occupancy;
+        }
+
+        void setBrick(BrickCoordinate bC, u8 octants)
+        {
+            const u64 bit = u64 {1} << ((bC.y * 8u) + bC.z);
+
+            if (octants != 0)
+            {
+                this->brick_mask[bC.x] |= bit;
+            }
+            else
+            {
+                this->brick_mask[bC.x] &= ~bit;
+            }
+
+            this->brick_octants[(bC.x * 64u) + (bC.y * 8u) + bC.z] = octants;
+        }
+
+        void setBrickFromMaterial(BrickCoordinate bC, u16 material)
+        {
+            this->setBrick(bC, material != 0 ? 0xFF : 0x00);
+        }
+
+        [[nodiscard]] bool isBrickOccupied(BrickCoordinate bC) const
+        {
+            return (this->brick_mask[bC.x] & (u64 {1} << ((bC.y * 8u) + bC.z))) != 0;
+        }
+
+        [[nodiscard]] bool isEmpty() const
+        {
+            return std::ranges::all_of(
+                this->brick_mask,
+                [](u64 m)
+                {
+                    return m == 0;
+                });
+        }
+
+        [[nodiscard]] u32 getNumberOfOccupiedBricks() const
+        {
+            u32 count = 0;
+
+            for (u64 m : this->brick_mask)
+            {
+                count += static_cast<u32>(std::popcount(m));
+            }
+
+            return count;
+        }
+
+        /// Conservative, true only if there are no solid voxels in the inclusive range [min, max]
+        /// Bricks partially covered by the range are checked at octant granularity
+        [[nodiscard]] bool isRegionEmpty(ChunkLocalPosition min, ChunkLocalPosition max) const
+        {
+            const glm::u8vec3 minBrick = min.asVector() / BrickSizeVoxels;
+            const glm::u8vec3 maxBrick = max.asVector() / BrickSizeVoxels;
+
+            // All the (y, z) bricks in range within a single x slice
+            const u64 zRun    = ((u64 {1} << (maxBrick.z - minBrick.z + 1)) - 1) << minBrick.z;
+            u64       rowMask = 0;
+
+            for (u32 y = minBrick.y; y <= maxBrick.y; ++y)
+            {
+                rowMask |= zRun << (y * 8);
+            }
+
+            for (u32 x = minBrick.x; x <= maxBrick.x; ++x)
+            {
+                u64 candidates = this->brick_mask[x] & rowMask;
+
+                while (candidates != 0)
+                {
+                    const u32 bit = static_cast<u32>(std::countr_zero(candidates));
+                    candidates &= candidates - 1;
+
+                    const glm::u32vec3 brickCorner = glm::u32vec3 {x, bit / 8, bit % 8} * u32 {BrickSizeVoxels};
+
+                    // Which half of this brick the range starts and ends in, along each axis
+                    const glm::u32vec3 lo =
+                        glm::clamp(glm::u32vec3 {min.asVector()}, brickCorner, brickCorner + 7u) - brickCorner;
+                    const glm::u32vec3 hi =
+                        glm::clamp(glm::u32vec3 {max.asVector()}, brickCorner, brickCorner + 7u) - brickCorner;
+
+                    u8 octantMask = 0;
+
+                    for (u32 oz = lo.z / 4; oz <= hi.z / 4; ++oz)
+                    {
+                        for (u32 oy = lo.y / 4; oy <= hi.y / 4; ++oy)
+                        {
+                            for (u32 ox = lo.x / 4; ox <= hi.x / 4; ++ox)
+                            {
+                                octantMask |= static_cast<u8>(1u << (ox + (2 * oy) + (4 * oz)));
+                            }
+                        }
+                    }
+
+                    if ((this->brick_octants[(x * 64) + bit] & octantMask) != 0)
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        void iterateOccupiedBricks(std::invocable<BrickCoordinate> auto func) const
+        {
+            for (u8 x = 0; x < 8; ++x)
+            {
+                u64 remaining = this->brick_mask[x];
+
+                while (remaining != 0)
+                {
+                    const u32 bit = static_cast<u32>(std::countr_zero(remaining));
+                    remaining &= remaining - 1;
+
+                    func(BrickCoordinate {
+                        glm::u8vec3 {x, static_cast<u8>(bit / 8), static_cast<u8>(bit % 8)}, UncheckedInDebugTag {}});
+                }
+            }
+        }
+
+        bool operator== (const ChunkOccupancy&) const = default;
+    };
+
     struct CpuChunkData
     {
         util::RangeAllocation brick_allocation; // change name
-
-        bool operator== (const CpuChunkData&) const = default;
+        // Mirror of the brick pointer table slots in brick_allocation, each is an id in the BrickStore
+        std::vector<u32>      brick_ids;
+        // Slots in brick_ids that were demoted back to a material and can be reused
+        std::vector<u16>      free_brick_offsets;
+        ChunkOccupancy        occupancy;
     };
 } // namespace gfx::generators::voxel
 
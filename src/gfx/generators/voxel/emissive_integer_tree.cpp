@@ -21,32 +21,32 @@ namespace gfx::generators::voxel
             return glm::distance2(sphereCenter, closestPointBetweenSphereAndCube) <= radius * radius;
         }
     } // namespace
-    EmissiveIntegerTree::EmissiveIntegerTree() = default;
+    EmissiveIntegerTree::EmissiveIntegerTree()
+        : data {static_cast<f32>(ChunkSizeVoxels)}
+    {}
 
     EmissiveIntegerTree::~EmissiveIntegerTree() = default;
 
     bool EmissiveIntegerTree::insert(WorldPosition p, f32 r, bool warnIfAlreadyExisting)
     {
-        const decltype(this->data)::const_iterator it = this->data.find(p);
+        const bool inserted = this->data.insert(p.asVector(), static_cast<glm::vec3>(p.asVector()), r);
 
-        if (it == this->data.cend())
-        {
-            this->data.insert({static_cast<glm::vec3>(p.asVector()), r});
-
-            return true;
-        }
-        else if (warnIfAlreadyExisting)
+        if (!inserted && warnIfAlreadyExisting)
         {
             log::warn("duplicate insertion of {}", glm::to_string(p.asVector()));
         }
 
-        return false;
+        return inserted;
+    }
+
+    bool EmissiveIntegerTree::erase(WorldPosition p)
+    {
+        return this->data.remove(p.asVector());
     }
 
-    void EmissiveIntegerTree::erase(WorldPosition p)
+    usize EmissiveIntegerTree::size() const
     {
-        this->data.erase(static_cast<glm::vec3>(p.asVector()));
-        // this->impl->tree.efficient_replace_and_optimise(p);
+        return this->data.size();
     }
 
     std::vector<WorldPosition> EmissiveIntegerTree::getPossibleInfluencingPoints(AlignedChunkCoordinate chunk)
@@ -58,15 +58,18 @@ namespace gfx::generators::voxel
         const glm::vec3 chunkMin = searchPoint.asVector();
         const glm::vec3 chunkMax = searchPoint.asVector() + static_cast<i32>(ChunkSizeVoxels);
 
-        for (const auto& [wP, r] : this->data)
-        {
-            if (doesCubeIntersectSphere(wP, r, chunkMin, chunkMax))
+        this->data.query(
+            chunkMin,
+            chunkMax,
+            [&](const glm::i32vec3& wP, glm::vec3 center, f32 r)
             {
-                out.push_back(WorldPosition {static_cast<glm::i32vec3>(wP)});
-            }
-        }
+                if (doesCubeIntersectSphere(center, r, chunkMin, chunkMax))
+                {
+                    out.push_back(WorldPosition {wP});
+                }
+            });
 
         return out;
     }
 
-} // namespace gfx::generators::voxel
\ No newline at end of file
+} // namespace gfx::generators::voxel
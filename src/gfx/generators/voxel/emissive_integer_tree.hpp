@@ -1,9 +1,8 @@
 #pragma once
 
 #include "data_structures.hpp"
+#include "gfx/generators/voxel/loose_spatial_grid.hpp"
 #include "util/util.hpp"
-#include <boost/container/flat_map.hpp>
-#include <compare>
 #include <vector>
 
 namespace gfx::generators::voxel
@@ -28,21 +27,16 @@ namespace gfx::generators::voxel
         bool insert(WorldPosition, f32 radius, bool warnIfAlreadyExisting = true);
 
         /// try remove the element, return false if there was no element in the tree
-        void erase(WorldPosition);
+        bool erase(WorldPosition);
 
-        // returns an unordered list of all elements inside the distance from the given point
+        [[nodiscard]] usize size() const;
+
+        // returns an unordered list of all elements whose radius reaches into the given chunk
         std::vector<WorldPosition> getPossibleInfluencingPoints(AlignedChunkCoordinate);
 
 
     private:
-        struct OrdVec3
-        {
-            bool operator() (const glm::vec3& l, const glm::vec3& r) const
-            {
-                return std::tuple {l.x, l.y, l.z} < std::tuple {r.x, r.y, r.z};
-            }
-        };
-
-        boost::container::flat_map<glm::vec3, f32, OrdVec3> data;
+        // spatially hashed by chunk sized cells, so a query only touches cells near the chunk
+        LooseSpatialGrid<glm::i32vec3> data;
     };
 } // namespace gfx::generators::voxel
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "emissive_light_extraction.hpp"
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/material.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+namespace gfx::generators::voxel
+{
+    namespace
+    {
+        // Scales the summed emission of a cluster into GpuRaytracedLight power, a single EmissiveWhite voxel
+        // ends up at a power of 2
+        constexpr f32 EmissionToPower = 0.25f;
+
+        constexpr u16 getLinearIndex(u32 x, u32 y, u32 z)
+        {
+            return static_cast<u16>(x + (8 * y) + (64 * z));
+        }
+    } // namespace
+
+    bool isVoxelEmissive(Voxel v)
+    {
+        static const std::array<bool, std::to_underlying(Voxel::MaxVoxel)> IsEmissive = []
+        {
+            std::array<bool, std::to_underlying(Voxel::MaxVoxel)> isEmissive {};
+
+            for (u16 i = 1; i < std::to_underlying(Voxel::MaxVoxel); ++i)
+            {
+                const glm::vec3 emission = getMaterialFromVoxel(static_cast<Voxel>(i)).emission_metallic.xyz();
+
+                isEmissive[i] = emission.x > 0.0f || emission.y > 0.0f || emission.z > 0.0f;
+            }
+
+            return isEmissive;
+        }();
+
+        return std::to_underlying(v) < IsEmissive.size() && IsEmissive[std::to_underlying(v)];
+    }
+
+    void clusterEmissiveVoxelsInBrick(const CombinedBrick& brick, BrickCoordinate bC, std::vector<EmissiveCluster>& out)
+    {
+        // Indexed linearly, x + 8y + 64z
+        std::array<bool, 512> isUnvisitedEmissive {};
+        bool                  anyEmissive = false;
+
+        for (u32 x = 0; x < 8; ++x)
+        {
+            for (u32 y = 0; y < 8; ++y)
+            {
+                for (u32 z = 0; z < 8; ++z)
+                {
+                    const Voxel v = static_cast<Voxel>(brick.material_brick.data[x][y][z]);
+
+                    if (v != Voxel::NullAirEmpty && isVoxelEmissive(v))
+                    {
+                        isUnvisitedEmissive[getLinearIndex(x, y, z)] = true;
+                        anyEmissive                                  = true;
+                    }
+                }
+            }
+        }
+
+        if (!anyEmissive)
+        {
+            return;
+        }
+
+        const glm::vec3 brickCorner = static_cast<glm::vec3>(bC.asVector()) * static_cast<f32>(BrickSizeVoxels);
+
+        std::array<u16, 512> stack {};
+
+        for (u16 seed = 0; seed < 512; ++seed)
+        {
+            if (!isUnvisitedEmissive[seed])
+            {
+                continue;
+            }
+
+            EmissiveCluster cluster {.center {0.0f}, .total_emission {0.0f}, .number_of_voxels {0}};
+            usize           stackSize = 0;
+
+            stack[stackSize++]        = seed;
+            isUnvisitedEmissive[seed] = false;
+
+            while (stackSize > 0)
+            {
+                const u16 idx = stack[--stackSize];
+                const u32 x   = idx % 8;
+                const u32 y   = (idx / 8) % 8;
+                const u32 z   = idx / 64;
+
+                cluster.center += glm::vec3 {x, y, z} + 0.5f;
+                cluster.total_emission +=
+                    getMaterialFromVoxel(static_cast<Voxel>(brick.material_brick.data[x][y][z]))
+                        .emission_metallic.xyz();
+                cluster.number_of_voxels += 1;
+
+                const auto tryPush = [&](u32 nX, u32 nY, u32 nZ)
+                {
+                    const u16 neighbor = getLinearIndex(nX, nY, nZ);
+
+                    if (isUnvisitedEmissive[neighbor])
+                    {
+                        isUnvisitedEmissive[neighbor] = false;
+                        stack[stackSize++]            = neighbor;
+                    }
+                };
+
+                if (x > 0)
+                {
+                    tryPush(x - 1, y, z);
+                }
+                if (x < 7)
+                {
+                    tryPush(x + 1, y, z);
+                }
+                if (y > 0)
+                {
+                    tryPush(x, y - 1, z);
+                }
+                if (y < 7)
+                {
+                    tryPush(x, y + 1, z);
+                }
+                if (z > 0)
+                {
+                    tryPush(x, y, z - 1);
+                }
+                if (z < 7)
+                {
+                    tryPush(x, y, z + 1);
+                }
+            }
+
+            cluster.center = brickCorner + (cluster.center / static_cast<f32>(cluster.number_of_voxels));
+
+            out.push_back(cluster);
+        }
+    }
+
+    void clusterEmissiveVoxelsInSolidBrick(Voxel v, BrickCoordinate bC, std::vector<EmissiveCluster>& out)
+    {
+        if (v == Voxel::NullAirEmpty || !isVoxelEmissive(v))
+        {
+            return;
+        }
+
+        constexpr u32 VoxelsPerBrick = BrickSizeVoxels * BrickSizeVoxels * BrickSizeVoxels;
+
+        out.push_back(EmissiveCluster {
+            .center {(static_cast<glm::vec3>(bC.asVector()) + 0.5f) * static_cast<f32>(BrickSizeVoxels)},
+            .total_emission {getMaterialFromVoxel(v).emission_metallic.xyz() * static_cast<f32>(VoxelsPerBrick)},
+            .number_of_voxels {VoxelsPerBrick},
+        });
+    }
+
+    GpuRaytracedLight makeLightFromEmissiveCluster(const EmissiveCluster& cluster, ChunkLocation location)
+    {
+        const f32 voxelSize = static_cast<f32>(location.getVoxelSizeUnits());
+
+        const glm::vec3 worldCenter =
+            static_cast<glm::vec3>(location.getChunkNegativeCornerLocation()) + (cluster.center * voxelSize);
+
+        const f32 brightestChannel =
+            std::max({cluster.total_emission.x, cluster.total_emission.y, cluster.total_emission.z});
+        const glm::vec3 color = cluster.total_emission / brightestChannel;
+
+        // roughly the radius of the cluster, so the falloff starts at its surface rather than its center
+        const f32 halfIntensityDistance =
+            std::max(0.5f, std::cbrt(static_cast<f32>(cluster.number_of_voxels)) / 2.0f) * voxelSize;
+
+        return GpuRaytracedLight {
+            .position_and_half_intensity_distance {worldCenter.x, worldCenter.y, worldCenter.z, halfIntensityDistance},
+            .color_and_power {color.x, color.y, color.z, brightestChannel * EmissionToPower},
+        };
+    }
+} // namespace gfx::generators::voxel
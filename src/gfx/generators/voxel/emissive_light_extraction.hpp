@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/material.hpp"
+#include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/util.hpp"
+#include <glm/vec3.hpp>
+#include <vector>
+
+namespace gfx::generators::voxel
+{
+    /// A 6-connected group of emissive voxels. Clusters never cross a brick boundary so that a change to one brick
+    /// only has to recluster that brick. Positions are in chunk local voxels.
+    struct EmissiveCluster
+    {
+        glm::vec3 center;
+        glm::vec3 total_emission;
+        u32       number_of_voxels;
+    };
+
+    [[nodiscard]] bool isVoxelEmissive(Voxel);
+
+    /// Appends every cluster in the brick at bC
+    void clusterEmissiveVoxelsInBrick(const CombinedBrick&, BrickCoordinate, std::vector<EmissiveCluster>& out);
+    /// A brick compacted to a single material is one cluster if that material is emissive
+    void clusterEmissiveVoxelsInSolidBrick(Voxel, BrickCoordinate, std::vector<EmissiveCluster>& out);
+
+    [[nodiscard]] GpuRaytracedLight makeLightFromEmissiveCluster(const EmissiveCluster&, ChunkLocation);
+} // namespace gfx::generators::voxel
@@ -1,4 +1,5 @@
 #include "generator.hpp"
+#include "gfx/generators/voxel/brick_kernels.hpp"
 #include "gfx/generators/voxel/data_structures.hpp"
 #include "gfx/generators/voxel/material.hpp"
 #include "gfx/generators/voxel/shared_data_structures.slang"
@@ -219,7 +220,126 @@ namespace gfx::generators::voxel
         std::uniform_int_distribution<> dist {-1024, 1024};
     }
 
-    std::pair<BrickMap, std::vector<CombinedBrick>> WorldGenerator::generateChunkPreDense(ChunkLocation chunkRoot) const
+    std::shared_ptr<const WorldGenerator::ColumnHeightmap>
+    WorldGenerator::getColumnHeightmap(ChunkLocation chunkRoot) const
+    {
+        const HeightmapKey key {
+            .x {chunkRoot.aligned_chunk_coordinate.x},
+            .z {chunkRoot.aligned_chunk_coordinate.z},
+            .lod {chunkRoot.lod},
+            .seed {this->seed},
+        };
+
+        std::shared_ptr<const ColumnHeightmap> maybeCached = this->heightmap_cache.lock(
+            [&](HeightmapCache& cache) -> std::shared_ptr<const ColumnHeightmap>
+            {
+                const auto it = cache.lookup.find(key);
+
+                if (it == cache.lookup.end())
+                {
+                    return nullptr;
+                }
+
+                cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+
+                return it->second->second;
+            });
+
+        if (maybeCached != nullptr)
+        {
+            return maybeCached;
+        }
+
+        // Generated outside of the lock, if two threads race on the same column one result is simply dropped
+        std::shared_ptr<const ColumnHeightmap> generated = this->generateColumnHeightmap(chunkRoot);
+
+        this->heightmap_cache.lock(
+            [&](HeightmapCache& cache)
+            {
+                if (cache.lookup.contains(key))
+                {
+                    return;
+                }
+
+                cache.entries.emplace_front(key, generated);
+                cache.lookup.emplace(key, cache.entries.begin());
+
+                if (cache.entries.size() > MaxCachedHeightmaps)
+                {
+                    cache.lookup.erase(cache.entries.back().first);
+                    cache.entries.pop_back();
+                }
+            });
+
+        return generated;
+    }
+
+    std::shared_ptr<const WorldGenerator::ColumnHeightmap>
+    WorldGenerator::generateColumnHeightmap(ChunkLocation chunkRoot) const
+    {
+        const voxel::WorldPosition root {chunkRoot.getChunkNegativeCornerLocation()};
+
+        const i32 integerScale = static_cast<i32>(chunkRoot.getVoxelSizeUnits());
+
+        auto gen2D = [&](float scale, std::size_t localSeed) -> std::unique_ptr<std::array<std::array<float, 64>, 64>>
+        {
+            std::unique_ptr<std::array<std::array<float, 64>, 64>> res {new std::array<std::array<float, 64>, 64>};
+
+            this->fractal->GenUniformGrid2D(
+                res->data()->data(),
+                root.x / integerScale,
+                root.z / integerScale,
+                64,
+                64,
+                scale,
+                static_cast<int>(localSeed));
+
+            return res;
+        };
+
+        auto gen3D =
+            [&](float       scale,
+                std::size_t localSeed) -> std::unique_ptr<std::array<std::array<std::array<float, 64>, 64>, 64>>
+        {
+            std::unique_ptr<std::array<std::array<std::array<float, 64>, 64>, 64>> res {
+                new std::array<std::array<std::array<float, 64>, 64>, 64>};
+
+            this->fractal->GenUniformGrid3D(
+                res->data()->data()->data(), root.x, root.z, root.y, 64, 64, 64, scale, static_cast<int>(localSeed));
+
+            return res;
+        };
+
+        auto height         = gen2D(static_cast<float>(integerScale) * 0.001f, this->seed + 487484);
+        auto bumpHeight     = gen2D(static_cast<float>(integerScale) * 0.01f, this->seed + 7373834);
+        auto mountainHeight = gen2D(static_cast<float>(integerScale) * 1.0f / 16384.0f, (this->seed * 3884) - 83483);
+        // auto mainRock    = gen3D(static_cast<float>(integerScale) * 0.001f, this->seed - 747875);
+        // auto pebblesRock = gen3D(static_cast<float>(integerScale) * 0.01f, this->seed -
+        // 52649274); auto pebbles     = gen3D(static_cast<float>(integerScale) * 0.05f, this->seed
+        // - 948);
+
+        std::shared_ptr<ColumnHeightmap> columnHeights = std::make_shared<ColumnHeightmap>();
+
+        columnHeights->min_height = std::numeric_limits<i32>::max();
+        columnHeights->max_height = std::numeric_limits<i32>::min();
+
+        for (usize j = 0; j < 64; ++j)
+        {
+            for (usize i = 0; i < 64; ++i)
+            {
+                const i32 h = static_cast<i32>(
+                    (*height)[j][i] * 32.0f + (*bumpHeight)[j][i] * 2.0f + (*mountainHeight)[j][i] * 1024.0f);
+
+                columnHeights->heights[j][i] = h;
+                columnHeights->min_height    = std::min(columnHeights->min_height, h);
+                columnHeights->max_height    = std::max(columnHeights->max_height, h);
+            }
+        }
+
+        return columnHeights;
+    }
+
+    GeneratedChunk WorldGenerator::generateChunkPreDense(ChunkLocation chunkRoot) const
     {
         // if (chunkRoot.aligned_chunk_coordinate == AlignedChunkCoordinate {0, 0, 1} && chunkRoot.lod == 0)
         // {
@@ -385,97 +505,147 @@ namespace gfx::generators::voxel
 
         const i32 integerScale = static_cast<i32>(chunkRoot.getVoxelSizeUnits());
 
-        auto gen2D = [&](float scale, std::size_t localSeed) -> std::unique_ptr<std::array<std::array<float, 64>, 64>>
-        {
-            std::unique_ptr<std::array<std::array<float, 64>, 64>> res {new std::array<std::array<float, 64>, 64>};
+        const std::shared_ptr<const ColumnHeightmap> heightmap     = this->getColumnHeightmap(chunkRoot);
+        const auto&                                  columnHeights = heightmap->heights;
 
-            this->fractal->GenUniformGrid2D(
-                res->data()->data(),
-                root.x / integerScale,
-                root.z / integerScale,
-                64,
-                64,
-                scale,
-                static_cast<int>(localSeed));
+        const u16 stone = static_cast<u16>(util::map<float>(0.76f, -1.0f, 1.0f, 14.0f, 18.0f)); // NOLINT
 
-            return res;
+        auto getVoxelAtRelativeDistance = [&](i32 relativeDistanceToHeight) -> u16
+        {
+            if (relativeDistanceToHeight < 0 * integerScale)
+            {
+                return stone;
+            }
+            else if (relativeDistanceToHeight < 2 * integerScale)
+            {
+                return std::to_underlying(Voxel::Dirt);
+            }
+            else if (relativeDistanceToHeight < 3 * integerScale)
+            {
+                return std::to_underlying(Voxel::Grass);
+            }
+
+            return std::to_underlying(Voxel::NullAirEmpty);
         };
 
-        auto gen3D =
-            [&](float       scale,
-                std::size_t localSeed) -> std::unique_ptr<std::array<std::array<std::array<float, 64>, 64>, 64>>
+        const i32 chunkBottomWorldHeight = root.y;
+        const i32 chunkTopWorldHeight    = root.y + (63 * integerScale);
+
+        // Most chunks lie entirely above or below the surface band, those don't need to be looked at per voxel
+        if (getVoxelAtRelativeDistance((chunkTopWorldHeight - heightmap->min_height) + (4 * integerScale)) == stone)
         {
-            std::unique_ptr<std::array<std::array<std::array<float, 64>, 64>, 64>> res {
-                new std::array<std::array<std::array<float, 64>, 64>, 64>};
+            BrickMap solidBrickMap {};
 
-            this->fractal->GenUniformGrid3D(
-                res->data()->data()->data(), root.x, root.z, root.y, 64, 64, 64, scale, static_cast<int>(localSeed));
+            for (auto& yz : solidBrickMap)
+            {
+                for (auto& z : yz)
+                {
+                    z.fill(MaybeBrickOffsetOrMaterialId::fromMaterial(stone));
+                }
+            }
 
-            return res;
-        };
+            return GeneratedChunk {.brick_map {solidBrickMap}, .bricks {}, .is_empty {false}};
+        }
 
-        auto height         = gen2D(static_cast<float>(integerScale) * 0.001f, this->seed + 487484);
-        auto bumpHeight     = gen2D(static_cast<float>(integerScale) * 0.01f, this->seed + 7373834);
-        auto mountainHeight = gen2D(static_cast<float>(integerScale) * 1.0f / 16384.0f, (this->seed * 3884) - 83483);
-        // auto mainRock    = gen3D(static_cast<float>(integerScale) * 0.001f, this->seed - 747875);
-        // auto pebblesRock = gen3D(static_cast<float>(integerScale) * 0.01f, this->seed -
-        // 52649274); auto pebbles     = gen3D(static_cast<float>(integerScale) * 0.05f, this->seed
-        // - 948);
+        if (getVoxelAtRelativeDistance((chunkBottomWorldHeight - heightmap->max_height) + (4 * integerScale))
+            == std::to_underlying(Voxel::NullAirEmpty))
+        {
+            // default constructed brick pointers are already air
+            return GeneratedChunk {.brick_map {}, .bricks {}, .is_empty {true}};
+        }
 
-        std::vector<std::pair<ChunkLocalPosition, Voxel>> out {};
-        out.reserve(32768);
+        BrickMap                   brickMap {};
+        std::vector<CombinedBrick> combinedBricks {};
+        bool                       isEmpty = true;
 
-        for (u8 j = 0; j < 64; ++j)
+        for (u8 bCX = 0; bCX < 8; ++bCX)
         {
-            for (u8 i = 0; i < 64; ++i)
+            for (u8 bCZ = 0; bCZ < 8; ++bCZ)
             {
-                // const i32 unscaledWorldHeight =
-                //     static_cast<i32>(std::exp2((*height)[j][i] * 12.0f));
+                // The surface band of this stack of bricks, every brick in it that lies entirely above or below
+                // this band is homogeneous and never needs to be materialised
+                i32 minColumnHeight = std::numeric_limits<i32>::max();
+                i32 maxColumnHeight = std::numeric_limits<i32>::min();
 
-                const i32 unscaledWorldHeight = static_cast<i32>(
-                    (*height)[j][i] * 32.0f + (*bumpHeight)[j][i] * 2.0f + (*mountainHeight)[j][i] * 1024.0f);
+                for (usize bPZ = 0; bPZ < 8; ++bPZ)
+                {
+                    for (usize bPX = 0; bPX < 8; ++bPX)
+                    {
+                        const i32 h     = columnHeights[(bCZ * 8) + bPZ][(bCX * 8) + bPX];
+                        minColumnHeight = std::min(minColumnHeight, h);
+                        maxColumnHeight = std::max(maxColumnHeight, h);
+                    }
+                }
 
-                for (u8 h = 0; h < 64; ++h)
+                for (u8 bCY = 0; bCY < 8; ++bCY)
                 {
-                    const i32 worldHeightOfVoxel = static_cast<i32>(h * chunkRoot.getVoxelSizeUnits()) + root.y;
-                    const i32 relativeDistanceToHeight =
-                        (worldHeightOfVoxel - unscaledWorldHeight) + (4 * integerScale);
+                    MaybeBrickOffsetOrMaterialId& brickPointer = brickMap[bCX][bCY][bCZ];
 
-                    if (relativeDistanceToHeight < 0 * integerScale)
+                    const i32 brickBottomWorldHeight = (bCY * 8 * integerScale) + root.y;
+                    const i32 brickTopWorldHeight    = brickBottomWorldHeight + (7 * integerScale);
+
+                    // Voxels go stone -> dirt -> grass -> air as they get higher above the surface
+                    if (getVoxelAtRelativeDistance((brickTopWorldHeight - minColumnHeight) + (4 * integerScale))
+                        == stone)
                     {
-                        out.push_back(
-                            std::pair {
-                                voxel::ChunkLocalPosition {{i, h, j}},
-                                static_cast<voxel::Voxel>(util::map<float>(
-                                    0.76f,
-                                    -1.0f,
-                                    1.0f,
-                                    14.0f,
-                                    18.0f)), // NOLINT
-                            });
+                        brickPointer = MaybeBrickOffsetOrMaterialId::fromMaterial(stone);
+                        isEmpty      = false;
+                        continue;
                     }
-                    else if (relativeDistanceToHeight < 2 * integerScale)
+
+                    if (getVoxelAtRelativeDistance((brickBottomWorldHeight - maxColumnHeight) + (4 * integerScale))
+                        == std::to_underlying(Voxel::NullAirEmpty))
                     {
-                        out.push_back(
-                            std::pair {
-                                voxel::ChunkLocalPosition {{i, h, j}},
-                                voxel::Voxel::Dirt,
-                            });
+                        brickPointer = MaybeBrickOffsetOrMaterialId::fromMaterial(0);
+                        continue;
                     }
-                    else if (relativeDistanceToHeight < 3 * integerScale)
 
+                    CombinedBrick& workingBrick = combinedBricks.emplace_back();
+
+                    for (u8 bPX = 0; bPX < 8; ++bPX)
+                    {
+                        for (u8 bPZ = 0; bPZ < 8; ++bPZ)
+                        {
+                            const i32 columnHeight = columnHeights[(bCZ * 8) + bPZ][(bCX * 8) + bPX];
+
+                            for (u8 bPY = 0; bPY < 8; ++bPY)
+                            {
+                                const i32 worldHeightOfVoxel =
+                                    static_cast<i32>((bCY * 8) + bPY) * integerScale + root.y;
+
+                                const u16 v = getVoxelAtRelativeDistance(
+                                    (worldHeightOfVoxel - columnHeight) + (4 * integerScale));
+
+                                if (v != std::to_underlying(Voxel::NullAirEmpty))
+                                {
+                                    workingBrick.write(
+                                        BrickLocalPosition {
+                                            BrickLocalPosition::VectorType {bPX, bPY, bPZ}, UncheckedInDebugTag {}},
+                                        v);
+                                }
+                            }
+                        }
+                    }
+
+                    const CombinedBrickReadResult compactResult = isCombinedBrickCompact(workingBrick);
+
+                    isEmpty = false;
+
+                    if (compactResult.solid)
+                    {
+                        brickPointer = MaybeBrickOffsetOrMaterialId::fromMaterial(compactResult.voxel);
+                        combinedBricks.pop_back();
+                    }
+                    else
                     {
-                        out.push_back(
-                            std::pair {
-                                voxel::ChunkLocalPosition {{i, h, j}},
-                                voxel::Voxel::Grass,
-                            });
+                        brickPointer = MaybeBrickOffsetOrMaterialId::fromOffset(
+                            static_cast<u16>(combinedBricks.size() - 1));
                     }
                 }
             }
         }
 
-        return createDenseChunk(out);
+        return GeneratedChunk {.brick_map {brickMap}, .bricks {std::move(combinedBricks)}, .is_empty {isEmpty}};
     }
 
 } // namespace gfx::generators::voxel
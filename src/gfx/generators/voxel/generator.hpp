@@ -3,20 +3,80 @@
 #include "gfx/generators/voxel/data_structures.hpp"
 #include "gfx/generators/voxel/material.hpp"
 #include "shared_data_structures.slang"
+#include "util/threads.hpp"
 #include "util/util.hpp"
 #include <FastNoise/FastNoise.h>
+#include <list>
+#include <memory>
+#include <unordered_map>
 
 namespace gfx::generators::voxel
 {
 
+    struct GeneratedChunk
+    {
+        BrickMap                   brick_map;
+        std::vector<CombinedBrick> bricks;
+        // Every voxel in this chunk is air, there's no reason to give it to the VoxelRenderer
+        bool                       is_empty;
+    };
+
     class WorldGenerator
     {
     public:
         explicit WorldGenerator(u64 seed);
 
-        [[nodiscard]] std::pair<BrickMap, std::vector<CombinedBrick>> generateChunkPreDense(ChunkLocation) const;
+        [[nodiscard]] GeneratedChunk generateChunkPreDense(ChunkLocation) const;
 
     private:
+        struct ColumnHeightmap
+        {
+            // Surface height of each column in a chunk, in world units, indexed [z][x]
+            std::array<std::array<i32, 64>, 64> heights;
+            i32                                 min_height;
+            i32                                 max_height;
+        };
+
+        // Every chunk in a vertical stack shares the same heightmap, so we only pay for the noise once per column
+        static constexpr usize MaxCachedHeightmaps = 2048;
+
+        struct HeightmapKey
+        {
+            i32 x;
+            i32 z;
+            u32 lod;
+            u64 seed;
+
+            bool operator== (const HeightmapKey&) const = default;
+        };
+
+        struct HeightmapKeyHash
+        {
+            usize operator() (const HeightmapKey& k) const
+            {
+                u64 hash = 14695981039346656037ULL;
+                hash     = util::hashCombine(hash, static_cast<u64>(static_cast<u32>(k.x)));
+                hash     = util::hashCombine(hash, static_cast<u64>(static_cast<u32>(k.z)));
+                hash     = util::hashCombine(hash, k.lod);
+                hash     = util::hashCombine(hash, k.seed);
+
+                return static_cast<usize>(hash);
+            }
+        };
+
+        // Least recently used entries are at the back
+        struct HeightmapCache
+        {
+            using Entry = std::pair<HeightmapKey, std::shared_ptr<const ColumnHeightmap>>;
+
+            std::list<Entry>                                                               entries;
+            std::unordered_map<HeightmapKey, std::list<Entry>::iterator, HeightmapKeyHash> lookup;
+        };
+
+        [[nodiscard]] std::shared_ptr<const ColumnHeightmap> getColumnHeightmap(ChunkLocation) const;
+        [[nodiscard]] std::shared_ptr<const ColumnHeightmap> generateColumnHeightmap(ChunkLocation) const;
+
+        mutable util::Mutex<HeightmapCache> heightmap_cache;
 
         FastNoise::SmartNode<FastNoise::Simplex>    simplex;
         FastNoise::SmartNode<FastNoise::FractalFBm> fractal;
@@ -3,18 +3,15 @@
 #include "gfx/generators/voxel/shared_data_structures.slang"
 #include "gfx/transform.hpp"
 #include "util/logger.hpp"
-#include "util/timer.hpp"
-#include <boost/geometry/algorithms/detail/intersects/interface.hpp>
-#include <boost/geometry/algorithms/detail/overlaps/interface.hpp>
-#include <boost/geometry/geometries/box.hpp>
-#include <boost/geometry/geometries/point.hpp>
-#include <boost/geometry/index/distance_predicates.hpp>
-#include <boost/geometry/index/predicates.hpp>
-#include <boost/geometry/index/rtree.hpp>
-#include <boost/geometry/io/io.hpp>
-#include <iostream>
-#include <iterator>
-#include <string>
+#include <algorithm>
+#include <cmath>
+#include <expected>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+#include <limits>
+#include <span>
+#include <utility>
 #include <vector>
 
 namespace gfx::generators::voxel
@@ -32,137 +29,441 @@ namespace gfx::generators::voxel
 
             return glm::distance2(sphereCenter, closestPointBetweenSphereAndCube) <= radius * radius;
         }
+
+        // TODO: this isnt great but dont make a shitton of weak lights! use an area light
+        // TODO: add area lights :skull:
+        // TODO: generate a list of lights per chunk and then do that to get this number correctly
+        f32 getInfluenceRadius(const GpuRaytracedLight& light)
+        {
+            return light.getMaxInfluenceDistance(1);
+        }
+
+        // Upper bound of the light's intensity anywhere in the cube, same falloff as voxel_tracing.slang
+        f32 estimateContribution(const GpuRaytracedLight& light, glm::vec3 cubeMin, glm::vec3 cubeMax)
+        {
+            const glm::vec3 position = light.position_and_half_intensity_distance.xyz();
+            const f32       r        = std::max(light.position_and_half_intensity_distance.w, 0.001f);
+            const f32       d        = glm::distance(position, glm::clamp(position, cubeMin, cubeMax)) / r;
+
+            return light.color_and_power.w / ((d * d) + 1.0f);
+        }
+
+        // Lights already in a chunk's list must be beaten by this factor to be evicted
+        constexpr f32 IncumbentLightBias = 1.25f;
     } // namespace
 
-    LightInfluenceStorage::LightInfluenceStorage(usize maxLightId)
-        : would_pack_benefit {false}
+    LightInfluenceStorage::LightInfluenceStorage(usize maxLightId, usize maxAggregateLights)
+        : lights_per_chunk {DefaultLightsPerChunk}
+        , light_grid {static_cast<f32>(ChunkSizeVoxels)}
+        , max_light_id {maxLightId}
+        , aggregate_allocator {static_cast<u32>(maxAggregateLights)}
+        , has_warned_about_aggregate_exhaustion {false}
     {
+        assert::critical(
+            maxLightId + maxAggregateLights <= NoAggregateLight,
+            "{} lights and {} aggregates do not fit in a u16",
+            maxLightId,
+            maxAggregateLights);
+
         this->light_lookup.resize(maxLightId);
+        this->light_aggregate_cells.resize(maxLightId);
     }
 
     LightInfluenceStorage::~LightInfluenceStorage() = default;
 
-    LightInfluenceStorage::R3Box getAABBFromLight(GpuRaytracedLight light)
+    void LightInfluenceStorage::insert(u16 lightId, GpuRaytracedLight light)
     {
-        // TODO: this isnt great but dont make a shitton of weak lights! use an area light
-        // TODO: add area lights :skull:
-        // TODO: generate a list of lights per chunk and then do that to get this number correctly
-        const f32 maxInfluenceDistance = light.getMaxInfluenceDistance(1);
+        const glm::vec3 position = light.position_and_half_intensity_distance.xyz();
+        const f32       radius   = getInfluenceRadius(light);
 
-        const glm::vec3 lightPositionGLM = light.position_and_half_intensity_distance.xyz();
+        const bool inserted = this->light_grid.insert(lightId, position, radius);
 
-        const LightInfluenceStorage::R3Point minLightAABB {
-            lightPositionGLM.x - maxInfluenceDistance,
-            lightPositionGLM.y - maxInfluenceDistance,
-            lightPositionGLM.z - maxInfluenceDistance};
-        const LightInfluenceStorage::R3Point maxLightAABB {
-            lightPositionGLM.x + maxInfluenceDistance,
-            lightPositionGLM.y + maxInfluenceDistance,
-            lightPositionGLM.z + maxInfluenceDistance};
+        assert::warn(inserted, "Duplicate insertion of light {}", lightId);
 
-        return LightInfluenceStorage::R3Box {minLightAABB, maxLightAABB};
-    }
+        if (!inserted)
+        {
+            return;
+        }
 
-    void LightInfluenceStorage::insert(u16 lightId, GpuRaytracedLight light)
-    {
-        this->tree_storage.insert(std::make_pair(getAABBFromLight(light), lightId));
         this->light_lookup[lightId] = light;
+        this->markDirty(position, radius);
 
-        this->would_pack_benefit = true;
+        this->light_aggregate_cells[lightId] = getAggregateCellOfLight(light);
+        this->addToAggregate(lightId, this->light_aggregate_cells[lightId]);
     }
 
     void LightInfluenceStorage::update(u16 lightId, GpuRaytracedLight light)
     {
-        if (light == this->light_lookup[lightId])
+        this->updateImpl(lightId, light, true);
+    }
+
+    void LightInfluenceStorage::remove(u16 lightId)
+    {
+        const bool removed = this->light_grid.remove(lightId);
+
+        assert::warn(removed, "Tried to removed light {} and failed", lightId);
+
+        if (removed)
         {
-            log::warn("Identical update of light {}", lightId);
+            const GpuRaytracedLight& oldLight = this->light_lookup[lightId];
+
+            this->markDirty(oldLight.position_and_half_intensity_distance.xyz(), getInfluenceRadius(oldLight));
+            this->removeFromAggregate(lightId, this->light_aggregate_cells[lightId]);
+        }
+    }
+
+    void LightInfluenceStorage::insert(std::span<const std::pair<u16, GpuRaytracedLight>> lights)
+    {
+        this->dirty_regions.reserve(this->dirty_regions.size() + lights.size());
+
+        for (const auto& [lightId, light] : lights)
+        {
+            this->insert(lightId, light);
+        }
+    }
+
+    void LightInfluenceStorage::update(std::span<const std::pair<u16, GpuRaytracedLight>> lights)
+    {
+        this->dirty_regions.reserve(this->dirty_regions.size() + lights.size());
+
+        for (const auto& [lightId, light] : lights)
+        {
+            this->updateImpl(lightId, light, false);
+        }
+    }
+
+    void LightInfluenceStorage::remove(std::span<const u16> lightIds)
+    {
+        this->dirty_regions.reserve(this->dirty_regions.size() + lightIds.size());
+
+        for (const u16 lightId : lightIds)
+        {
+            this->remove(lightId);
+        }
+    }
+
+    void LightInfluenceStorage::updateImpl(u16 lightId, GpuRaytracedLight light, bool warnIfIdentical)
+    {
+        const GpuRaytracedLight oldLight = this->light_lookup[lightId];
+
+        if (light == oldLight)
+        {
+            if (warnIfIdentical)
+            {
+                log::warn("Identical update of light {}", lightId);
+            }
+
             return;
         }
 
-        this->would_pack_benefit = true;
+        const glm::vec3 position = light.position_and_half_intensity_distance.xyz();
+        const f32       radius   = getInfluenceRadius(light);
+
+        const bool updated = this->light_grid.update(lightId, position, radius);
+
+        assert::warn(updated, "Tried to update light {} which was never inserted", lightId);
+
+        if (!updated)
+        {
+            return;
+        }
+
+        this->light_lookup[lightId] = light;
+        this->markDirtyMoved(
+            oldLight.position_and_half_intensity_distance.xyz(), getInfluenceRadius(oldLight), position, radius);
 
-        this->remove(lightId);
+        const glm::ivec3 oldCell = this->light_aggregate_cells[lightId];
+        const glm::ivec3 newCell = getAggregateCellOfLight(light);
 
-        this->insert(lightId, light);
+        if (oldCell != newCell)
+        {
+            this->removeFromAggregate(lightId, oldCell);
+            this->addToAggregate(lightId, newCell);
+            this->light_aggregate_cells[lightId] = newCell;
+        }
+        else
+        {
+            this->dirty_aggregate_cells.insert(oldCell);
+        }
     }
 
-    void LightInfluenceStorage::remove(u16 lightId)
+    glm::ivec3 LightInfluenceStorage::getAggregateCellOfLight(const GpuRaytracedLight& light)
     {
-        const bool removed =
-            this->tree_storage.remove(std::make_pair(getAABBFromLight(this->light_lookup[lightId]), lightId)) == 1;
+        return static_cast<glm::ivec3>(
+            glm::floor(glm::vec3 {light.position_and_half_intensity_distance.xyz()} / AggregateCellWidth));
+    }
 
-        assert::warn(removed, "Tried to removed light {} and failed", lightId);
+    void LightInfluenceStorage::addToAggregate(u16 lightId, glm::ivec3 cell)
+    {
+        const auto [it, inserted] = this->aggregate_cells.try_emplace(cell);
 
-        if (removed)
+        if (inserted)
         {
-            this->would_pack_benefit = true;
+            it->second.aggregate_light_id = NoAggregateLight;
         }
+
+        it->second.light_ids.push_back(lightId);
+        this->dirty_aggregate_cells.insert(cell);
+    }
+
+    void LightInfluenceStorage::removeFromAggregate(u16 lightId, glm::ivec3 cell)
+    {
+        const auto it = this->aggregate_cells.find(cell);
+
+        assert::critical(it != this->aggregate_cells.end(), "Light {} was not in an aggregate cell", lightId);
+
+        std::vector<u16>& lightIds = it->second.light_ids;
+        const auto        idIt     = std::ranges::find(lightIds, lightId);
+
+        assert::critical(idIt != lightIds.end(), "Light {} was not in its aggregate cell", lightId);
+
+        *idIt = lightIds.back();
+        lightIds.pop_back();
+
+        this->dirty_aggregate_cells.insert(cell);
     }
 
-    bool LightInfluenceStorage::pack()
+    std::pmr::vector<std::pair<u16, GpuRaytracedLight>>
+    LightInfluenceStorage::updateAggregates(std::pmr::memory_resource* resource)
     {
-        const bool didPackOccur = this->would_pack_benefit;
+        std::pmr::vector<std::pair<u16, GpuRaytracedLight>> changedAggregates {resource};
 
-        if (this->would_pack_benefit)
+        for (const glm::ivec3& cell : this->dirty_aggregate_cells)
         {
-            util::Timer t {"LightInfluenceStorage::pack()"};
+            const auto it = this->aggregate_cells.find(cell);
+
+            if (it == this->aggregate_cells.end())
+            {
+                continue;
+            }
+
+            AggregateCell& aggregate = it->second;
+
+            if (aggregate.light_ids.empty())
+            {
+                if (aggregate.aggregate_light_id != NoAggregateLight)
+                {
+                    this->aggregate_allocator.free(aggregate.aggregate_light_id - this->max_light_id);
+                }
+
+                this->aggregate_cells.erase(it);
+
+                continue;
+            }
+
+            // Matches the far field of the falloff, p / (1 + (d / r)^2) tends to p * r^2 / d^2, so the aggregate
+            // keeps the summed power and the power weighted mean of r^2. Position and color are power weighted
+            f32       totalPower           = 0.0f;
+            f32       weightedRadiusSquare = 0.0f;
+            glm::vec3 weightedPosition {0.0f};
+            glm::vec3 weightedColor {0.0f};
 
-            decltype(this->tree_storage) newTree {this->tree_storage.begin(), this->tree_storage.end()};
+            for (const u16 lightId : aggregate.light_ids)
+            {
+                const GpuRaytracedLight& light = this->light_lookup[lightId];
+                const f32                power = light.color_and_power.w;
+                const f32                r     = light.position_and_half_intensity_distance.w;
+
+                totalPower += power;
+                weightedRadiusSquare += power * r * r;
+                weightedPosition += power * glm::vec3 {light.position_and_half_intensity_distance.xyz()};
+                weightedColor += power * glm::vec3 {light.color_and_power.xyz()};
+            }
+
+            if (totalPower <= 0.0f)
+            {
+                totalPower = std::numeric_limits<f32>::min();
+            }
 
-            this->tree_storage = std::move(newTree);
+            const glm::vec3 position = weightedPosition / totalPower;
 
-            this->would_pack_benefit = false;
+            const GpuRaytracedLight newAggregateLight {
+                .position_and_half_intensity_distance {
+                    position.x, position.y, position.z, std::sqrt(weightedRadiusSquare / totalPower)},
+                .color_and_power {weightedColor / totalPower, totalPower},
+            };
 
-            if (auto e = t.end(false); e > 1000)
+            if (aggregate.aggregate_light_id == NoAggregateLight)
             {
-                log::warn("is this too long? {}", e);
+                const std::expected<u32, util::IndexAllocator::OutOfBlocks> maybeSlot =
+                    this->aggregate_allocator.allocate();
+
+                if (!maybeSlot.has_value())
+                {
+                    if (!this->has_warned_about_aggregate_exhaustion)
+                    {
+                        log::warn("Out of aggregate lights, distant lights will be listed individually");
+
+                        this->has_warned_about_aggregate_exhaustion = true;
+                    }
+
+                    continue;
+                }
+
+                aggregate.aggregate_light_id = static_cast<u16>(this->max_light_id + *maybeSlot);
             }
+            else if (newAggregateLight == aggregate.aggregate_light)
+            {
+                continue;
+            }
+
+            aggregate.aggregate_light = newAggregateLight;
+            changedAggregates.push_back({aggregate.aggregate_light_id, newAggregateLight});
         }
 
-        return didPackOccur;
+        this->dirty_aggregate_cells.clear();
+
+        return changedAggregates;
+    }
+
+    std::pmr::vector<LightInfluenceStorage::DirtyRegion>
+    LightInfluenceStorage::takeDirtyRegions(std::pmr::memory_resource* resource)
+    {
+        std::pmr::vector<DirtyRegion> regions {this->dirty_regions.begin(), this->dirty_regions.end(), resource};
+
+        // cleared rather than moved out so the capacity is reused
+        this->dirty_regions.clear();
+
+        return regions;
     }
 
-    std::vector<u16> LightInfluenceStorage::poll(ChunkLocation cL)
+    void LightInfluenceStorage::markDirty(glm::vec3 center, f32 radius)
     {
-        const glm::vec3 glmMinimum = static_cast<glm::vec3>(cL.getChunkNegativeCornerLocation());
-        const glm::vec3 glmMaximum =
+        this->dirty_regions.push_back(DirtyRegion {.minimum {center - radius}, .maximum {center + radius}});
+    }
+
+    void LightInfluenceStorage::markDirtyMoved(glm::vec3 oldCenter, f32 oldRadius, glm::vec3 newCenter, f32 newRadius)
+    {
+        const glm::vec3 oldMinimum = oldCenter - oldRadius;
+        const glm::vec3 oldMaximum = oldCenter + oldRadius;
+        const glm::vec3 newMinimum = newCenter - newRadius;
+        const glm::vec3 newMaximum = newCenter + newRadius;
+
+        // a light that moved a little mostly covers the same chunks, one union box is cheaper to resolve than two
+        if (glm::all(glm::lessThanEqual(oldMinimum, newMaximum))
+            && glm::all(glm::lessThanEqual(newMinimum, oldMaximum)))
+        {
+            this->dirty_regions.push_back(
+                DirtyRegion {.minimum {glm::min(oldMinimum, newMinimum)}, .maximum {glm::max(oldMaximum, newMaximum)}});
+        }
+        else
+        {
+            this->markDirty(oldCenter, oldRadius);
+            this->markDirty(newCenter, newRadius);
+        }
+    }
+
+    std::pmr::vector<u16> LightInfluenceStorage::poll(
+        ChunkLocation cL, std::span<const u16> currentLightIds, std::pmr::memory_resource* resource)
+    {
+        const glm::vec3 chunkMinimum = static_cast<glm::vec3>(cL.getChunkNegativeCornerLocation());
+        const glm::vec3 chunkMaximum =
             static_cast<glm::vec3>(cL.getChunkNegativeCornerLocation() + static_cast<i32>(cL.getChunkWidthUnits()));
 
-        const R3Point minimum {glmMinimum.x, glmMinimum.y, glmMinimum.z};
-        const R3Point maximum {glmMaximum.x, glmMaximum.y, glmMaximum.z};
+        struct RankedLight
+        {
+            f32 score;
+            u16 light_id;
+        };
 
-        const R3Box sampleBox {minimum, maximum};
+        std::pmr::vector<RankedLight> rankedLights {resource};
+        std::pmr::vector<u16>         seenAggregateLightIds {resource};
 
-        std::vector<LightWithId> queryResult {};
+        const auto rankLight = [&](u16 lightId, const GpuRaytracedLight& light)
+        {
+            f32 score = estimateContribution(light, chunkMinimum, chunkMaximum);
 
-        std::ignore =
-            this->tree_storage.query(boost::geometry::index::intersects(sampleBox), std::back_inserter(queryResult));
+            if (std::ranges::binary_search(currentLightIds, lightId))
+            {
+                score *= IncumbentLightBias;
+            }
 
-        std::vector<u16> lightIds {};
+            rankedLights.push_back(RankedLight {.score {score}, .light_id {lightId}});
+        };
 
-        for (const auto& [box, lightId] : queryResult)
+        const auto isCellFar = [&](glm::ivec3 cell)
         {
-            const GpuRaytracedLight& light = this->light_lookup[lightId];
+            const glm::vec3 cellMinimum = static_cast<glm::vec3>(cell) * AggregateCellWidth;
+            const glm::vec3 cellMaximum = cellMinimum + AggregateCellWidth;
+            const glm::vec3 gap =
+                glm::max(glm::vec3 {0.0f}, glm::max(cellMinimum - chunkMaximum, chunkMinimum - cellMaximum));
+
+            return glm::length(gap) > AggregationDistance;
+        };
+
+        this->light_grid.query(
+            chunkMinimum,
+            chunkMaximum,
+            [&](u16 lightId, glm::vec3 position, f32 radius)
+            {
+                if (!doesCubeIntersectSphere(position, radius, chunkMinimum, chunkMaximum))
+                {
+                    return;
+                }
 
-            if (doesCubeIntersectSphere(
-                    light.position_and_half_intensity_distance.xyz(),
-                    light.getMaxInfluenceDistance(),
-                    {
-                        box.min_corner().get<0>(),
-                        box.min_corner().get<1>(),
-                        box.min_corner().get<2>(),
-                    },
+                const glm::ivec3 cell = this->light_aggregate_cells[lightId];
+
+                if (isCellFar(cell))
+                {
+                    const AggregateCell& aggregate = this->aggregate_cells.at(cell);
+
+                    // every far light in the cell is represented once by the aggregate
+                    if (aggregate.aggregate_light_id != NoAggregateLight)
                     {
-                        box.max_corner().get<0>(),
-                        box.max_corner().get<1>(),
-                        box.max_corner().get<2>(),
-                    }))
+                        if (std::ranges::find(seenAggregateLightIds, aggregate.aggregate_light_id)
+                            == seenAggregateLightIds.end())
+                        {
+                            seenAggregateLightIds.push_back(aggregate.aggregate_light_id);
+                            rankLight(aggregate.aggregate_light_id, aggregate.aggregate_light);
+                        }
+
+                        return;
+                    }
+                }
+
+                rankLight(lightId, this->light_lookup[lightId]);
+            });
+
+        if (rankedLights.size() > this->lights_per_chunk)
+        {
+            // ties are broken by id so the same inputs always select the same lights
+            const auto isMoreImportant = [](const RankedLight& l, const RankedLight& r)
             {
-                lightIds.push_back(lightId);
-            }
+                return l.score > r.score || (l.score == r.score && l.light_id < r.light_id);
+            };
+
+            std::ranges::nth_element(rankedLights, rankedLights.begin() + this->lights_per_chunk, isMoreImportant);
+
+            rankedLights.resize(this->lights_per_chunk);
+        }
+
+        std::pmr::vector<u16> lightIds {resource};
+        lightIds.reserve(rankedLights.size());
+
+        for (const RankedLight& l : rankedLights)
+        {
+            lightIds.push_back(l.light_id);
         }
 
+        std::ranges::sort(lightIds);
+
         return lightIds;
     }
 
-} // namespace gfx::generators::voxel
\ No newline at end of file
+    void LightInfluenceStorage::setLightsPerChunk(u16 newLightsPerChunk)
+    {
+        assert::warn(
+            newLightsPerChunk <= MaxLightsPerChunk,
+            "Requested {} lights per chunk, clamping to {}",
+            newLightsPerChunk,
+            MaxLightsPerChunk);
+
+        this->lights_per_chunk = std::min(newLightsPerChunk, MaxLightsPerChunk);
+    }
+
+    u16 LightInfluenceStorage::getLightsPerChunk() const
+    {
+        return this->lights_per_chunk;
+    }
+
+} // namespace gfx::generators::voxel
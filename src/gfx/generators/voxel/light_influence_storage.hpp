@@ -1,19 +1,45 @@
 #pragma once
 
 #include "data_structures.hpp"
+#include "gfx/generators/voxel/loose_spatial_grid.hpp"
 #include "gfx/generators/voxel/shared_data_structures.slang"
-#include <boost/geometry/algorithms/buffer.hpp>
-#include <boost/geometry/algorithms/intersection.hpp>
-#include <boost/geometry/algorithms/intersects.hpp>
-#include <boost/geometry/core/cs.hpp>
+#include "util/allocators/index_allocator.hpp"
+#include <limits>
+#include <memory_resource>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace gfx::generators::voxel
 {
+    /// Spatial index of every light, answering which lights matter to each chunk.
+    /// Lights are also binned into coarse aggregation cells. A chunk sees the individual lights of nearby cells, but
+    /// each far away cell is seen as a single aggregate light standing in for all of its lights, a two level
+    /// lightcut that keeps per chunk lists short however many lights there are.
     class LightInfluenceStorage
     {
     public:
+        /// World space bounds that a light's influence was added to or removed from
+        struct DirtyRegion
+        {
+            glm::vec3 minimum;
+            glm::vec3 maximum;
+        };
 
-        explicit LightInfluenceStorage(usize maxLightId);
+        // capacity of GpuChunkData::nearby_light_ids
+        static constexpr u16 MaxLightsPerChunk     = 1024;
+        static constexpr u16 DefaultLightsPerChunk = 64;
+
+        static constexpr f32 AggregateCellWidth = 512.0f;
+        // cells further than this from a chunk are represented by their aggregate
+        static constexpr f32 AggregationDistance = 512.0f;
+
+    public:
+
+        // Aggregate lights are given the ids [maxLightId, maxLightId + maxAggregateLights)
+        LightInfluenceStorage(usize maxLightId, usize maxAggregateLights);
         ~LightInfluenceStorage();
 
         LightInfluenceStorage(const LightInfluenceStorage&)             = delete;
@@ -26,22 +52,62 @@ namespace gfx::generators::voxel
         void update(u16 lightId, GpuRaytracedLight);
         void remove(u16 lightId);
 
-        // returns true if any lights changed
-        bool pack();
+        // Batched versions of the above, identical updates are silently skipped
+        void insert(std::span<const std::pair<u16, GpuRaytracedLight>>);
+        void update(std::span<const std::pair<u16, GpuRaytracedLight>>);
+        void remove(std::span<const u16> lightIds);
+
+        // The results of the functions below, and any scratch space they need, come from the given memory resource
 
-        std::vector<u16> poll(ChunkLocation);
+        // returns every region touched by an insert, update, or remove since the last call
+        // an update contributes both the light's old and new coverage
+        [[nodiscard]] std::pmr::vector<DirtyRegion>
+            takeDirtyRegions(std::pmr::memory_resource* = std::pmr::get_default_resource());
+
+        /// Recomputes the aggregates of every cell whose lights changed, returns the aggregate lights that need
+        /// uploading. Must be called before polling for the frame
+        [[nodiscard]] std::pmr::vector<std::pair<u16, GpuRaytracedLight>>
+            updateAggregates(std::pmr::memory_resource* = std::pmr::get_default_resource());
+
+        /// Returns the ids of the lights that contribute most to the chunk, at most getLightsPerChunk() of them,
+        /// sorted by id. Lights in currentLightIds (sorted) are favoured at the cutoff so the lists don't flicker
+        std::pmr::vector<u16> poll(
+            ChunkLocation,
+            std::span<const u16>       currentLightIds = {},
+            std::pmr::memory_resource* resource        = std::pmr::get_default_resource());
+
+        void              setLightsPerChunk(u16);
+        [[nodiscard]] u16 getLightsPerChunk() const;
 
     private:
+        static constexpr u16 NoAggregateLight = std::numeric_limits<u16>::max();
+
+        struct AggregateCell
+        {
+            u16               aggregate_light_id;
+            std::vector<u16>  light_ids;
+            GpuRaytracedLight aggregate_light;
+        };
 
-        using R3Point = boost::geometry::model::point<float, 3, boost::geometry::cs::cartesian>;
-        using R3Box   = boost::geometry::model::box<R3Point>;
+        [[nodiscard]] static glm::ivec3 getAggregateCellOfLight(const GpuRaytracedLight&);
+        void                            addToAggregate(u16 lightId, glm::ivec3 cell);
+        void                            removeFromAggregate(u16 lightId, glm::ivec3 cell);
 
-        using LightWithId = std::pair<R3Box, u16>;
+        void updateImpl(u16 lightId, GpuRaytracedLight, bool warnIfIdentical);
+        void markDirty(glm::vec3 center, f32 radius);
+        void markDirtyMoved(glm::vec3 oldCenter, f32 oldRadius, glm::vec3 newCenter, f32 newRadius);
 
-        bool                                                                          would_pack_benefit;
-        boost::geometry::index::rtree<LightWithId, boost::geometry::index::rstar<16>> tree_storage;
-        std::vector<GpuRaytracedLight>                                                light_lookup;
+        u16                            lights_per_chunk;
+        LooseSpatialGrid<u16>          light_grid;
+        std::vector<GpuRaytracedLight> light_lookup;
+        std::vector<DirtyRegion>       dirty_regions;
 
-        friend R3Box getAABBFromLight(GpuRaytracedLight);
+        usize                                         max_light_id;
+        util::IndexAllocator                          aggregate_allocator;
+        std::unordered_map<glm::ivec3, AggregateCell> aggregate_cells;
+        // The cell each light id is binned into
+        std::vector<glm::ivec3>                       light_aggregate_cells;
+        std::unordered_set<glm::ivec3>                dirty_aggregate_cells;
+        bool                                          has_warned_about_aggregate_exhaustion;
     };
-} // namespace gfx::generators::voxel
\ No newline at end of file
+} // namespace gfx::generators::voxel
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "util/util.hpp"
+#include <array>
+#include <concepts>
+#include <functional>
+#include <glm/common.hpp>
+#include <glm/ext/vector_uint3_sized.hpp>
+#include <glm/gtx/hash.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vector_relational.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace gfx::generators::voxel
+{
+    /// Hierarchical loose grid of spheres
+    /// Each sphere lives in exactly one cell, on the finest level whose cells are at least twice its radius wide,
+    /// so a cell's loose bounds (the cell grown by half its width on every side) always contain its spheres.
+    /// Moving a sphere is O(1) and there is nothing to rebuild or rebalance.
+    template<class Key, class KeyHash = std::hash<Key>>
+    class LooseSpatialGrid
+    {
+    public:
+        static constexpr u32 NumberOfLevels = 16;
+
+    public:
+        explicit LooseSpatialGrid(f32 baseCellWidth_)
+            : base_cell_width {baseCellWidth_}
+            , spheres_per_level {}
+        {}
+        ~LooseSpatialGrid() = default;
+
+        LooseSpatialGrid(const LooseSpatialGrid&)             = delete;
+        LooseSpatialGrid(LooseSpatialGrid&&)                  = default;
+        LooseSpatialGrid& operator= (const LooseSpatialGrid&) = delete;
+        LooseSpatialGrid& operator= (LooseSpatialGrid&&)      = default;
+
+        /// Returns false if the key was already present
+        bool insert(const Key& key, glm::vec3 center, f32 radius)
+        {
+            const auto [it, inserted] = this->entries.try_emplace(key);
+
+            if (!inserted)
+            {
+                return false;
+            }
+
+            Entry& entry = it->second;
+            entry.center = center;
+            entry.radius = radius;
+            this->link(key, entry);
+
+            return true;
+        }
+
+        /// Returns false if the key was not present
+        bool update(const Key& key, glm::vec3 center, f32 radius)
+        {
+            const auto it = this->entries.find(key);
+
+            if (it == this->entries.end())
+            {
+                return false;
+            }
+
+            Entry& entry = it->second;
+
+            const u32        newLevel = this->getLevelOfRadius(radius);
+            const glm::ivec3 newCell  = this->getCellOfPoint(center, newLevel);
+
+            entry.center = center;
+            entry.radius = radius;
+
+            if (newLevel != entry.level || newCell != entry.cell)
+            {
+                this->unlink(entry);
+                this->link(key, entry);
+            }
+
+            return true;
+        }
+
+        /// Returns false if the key was not present
+        bool remove(const Key& key)
+        {
+            const auto it = this->entries.find(key);
+
+            if (it == this->entries.end())
+            {
+                return false;
+            }
+
+            this->unlink(it->second);
+            this->entries.erase(it);
+
+            return true;
+        }
+
+        [[nodiscard]] bool contains(const Key& key) const
+        {
+            return this->entries.contains(key);
+        }
+
+        [[nodiscard]] usize size() const
+        {
+            return this->entries.size();
+        }
+
+        /// Calls func(key, center, radius) for every sphere whose cell's loose bounds overlap the box
+        /// This is a conservative superset, callers are expected to run their own exact test
+        void query(glm::vec3 minimum, glm::vec3 maximum, std::invocable<const Key&, glm::vec3, f32> auto func) const
+        {
+            for (const Key& k : this->unbounded)
+            {
+                const Entry& entry = this->entries.at(k);
+
+                func(k, entry.center, entry.radius);
+            }
+
+            for (u32 level = 0; level < NumberOfLevels; ++level)
+            {
+                if (this->spheres_per_level[level] == 0)
+                {
+                    continue;
+                }
+
+                const f32  halfCellWidth = this->getCellWidth(level) / 2.0f;
+                const auto visitCell     = [&](const std::vector<Key>& cell)
+                {
+                    for (const Key& k : cell)
+                    {
+                        const Entry& entry = this->entries.at(k);
+
+                        func(k, entry.center, entry.radius);
+                    }
+                };
+
+                const glm::ivec3   minimumCell = this->getCellOfPoint(minimum - halfCellWidth, level);
+                const glm::ivec3   maximumCell = this->getCellOfPoint(maximum + halfCellWidth, level);
+                const glm::u64vec3 extent      = static_cast<glm::u64vec3>(maximumCell - minimumCell + 1);
+
+                const std::unordered_map<glm::ivec3, std::vector<Key>>& cells = this->levels[level];
+
+                // Large boxes on fine levels are cheaper to answer by walking the occupied cells
+                if (extent.x * extent.y * extent.z > cells.size())
+                {
+                    for (const auto& [cell, keys] : cells)
+                    {
+                        if (glm::all(glm::greaterThanEqual(cell, minimumCell))
+                            && glm::all(glm::lessThanEqual(cell, maximumCell)))
+                        {
+                            visitCell(keys);
+                        }
+                    }
+
+                    continue;
+                }
+
+                for (i32 x = minimumCell.x; x <= maximumCell.x; ++x)
+                {
+                    for (i32 y = minimumCell.y; y <= maximumCell.y; ++y)
+                    {
+                        for (i32 z = minimumCell.z; z <= maximumCell.z; ++z)
+                        {
+                            if (const auto it = cells.find(glm::ivec3 {x, y, z}); it != cells.end())
+                            {
+                                visitCell(it->second);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        static constexpr u32 UnboundedLevel = NumberOfLevels;
+
+        struct Entry
+        {
+            glm::vec3  center;
+            f32        radius;
+            u32        level;
+            glm::ivec3 cell;
+            u32        index_in_cell;
+        };
+
+        [[nodiscard]] f32 getCellWidth(u32 level) const
+        {
+            return this->base_cell_width * static_cast<f32>(1u << level);
+        }
+
+        [[nodiscard]] u32 getLevelOfRadius(f32 radius) const
+        {
+            for (u32 level = 0; level < NumberOfLevels; ++level)
+            {
+                if (radius * 2.0f <= this->getCellWidth(level))
+                {
+                    return level;
+                }
+            }
+
+            return UnboundedLevel;
+        }
+
+        [[nodiscard]] glm::ivec3 getCellOfPoint(glm::vec3 point, u32 level) const
+        {
+            if (level == UnboundedLevel)
+            {
+                return glm::ivec3 {0};
+            }
+
+            return static_cast<glm::ivec3>(glm::floor(point / this->getCellWidth(level)));
+        }
+
+        std::vector<Key>& getStorage(u32 level, glm::ivec3 cell)
+        {
+            if (level == UnboundedLevel)
+            {
+                return this->unbounded;
+            }
+
+            return this->levels[level][cell];
+        }
+
+        void link(const Key& key, Entry& entry)
+        {
+            entry.level = this->getLevelOfRadius(entry.radius);
+            entry.cell  = this->getCellOfPoint(entry.center, entry.level);
+
+            std::vector<Key>& storage = this->getStorage(entry.level, entry.cell);
+
+            entry.index_in_cell = static_cast<u32>(storage.size());
+            storage.push_back(key);
+
+            if (entry.level != UnboundedLevel)
+            {
+                this->spheres_per_level[entry.level] += 1;
+            }
+        }
+
+        void unlink(const Entry& entry)
+        {
+            std::vector<Key>& storage = this->getStorage(entry.level, entry.cell);
+
+            // swap remove, the moved key's entry needs to know where it went
+            if (entry.index_in_cell != storage.size() - 1)
+            {
+                storage[entry.index_in_cell] = std::move(storage.back());
+
+                this->entries.at(storage[entry.index_in_cell]).index_in_cell = entry.index_in_cell;
+            }
+
+            storage.pop_back();
+
+            if (entry.level != UnboundedLevel)
+            {
+                this->spheres_per_level[entry.level] -= 1;
+
+                if (storage.empty())
+                {
+                    this->levels[entry.level].erase(entry.cell);
+                }
+            }
+        }
+
+        f32                                                                          base_cell_width;
+        std::unordered_map<Key, Entry, KeyHash>                                      entries;
+        std::array<std::unordered_map<glm::ivec3, std::vector<Key>>, NumberOfLevels> levels;
+        std::array<u32, NumberOfLevels>                                              spheres_per_level;
+        std::vector<Key>                                                             unbounded;
+    };
+} // namespace gfx::generators::voxel
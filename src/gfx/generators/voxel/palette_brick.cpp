@@ -0,0 +1,181 @@
+#include "palette_brick.hpp"
+#include "gfx/generators/voxel/material.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace gfx::generators::voxel
+{
+    namespace
+    {
+        // Every material id must fit in an 8 bit index
+        static_assert(std::to_underlying(Voxel::MaxVoxel) <= 256);
+
+        // Calls func(linearIndex, material) for every solid voxel, walking the set bits of the BooleanBrick
+        // instead of reading all 512 voxels
+        void forEachSolidVoxel(const CombinedBrick& brick, std::invocable<u32, u16> auto func)
+        {
+            for (u32 word = 0; word < 16; ++word)
+            {
+                u32 remaining = brick.boolean_brick.data[word];
+
+                while (remaining != 0)
+                {
+                    const u32 linearIndex = (word * 32) + static_cast<u32>(std::countr_zero(remaining));
+                    remaining &= remaining - 1;
+
+                    // BooleanBrick indices are x + 8y + 64z, MaterialBrick is stored [x][y][z]
+                    func(
+                        linearIndex,
+                        brick.material_brick.data[linearIndex % 8][(linearIndex / 8) % 8][linearIndex / 64]);
+                }
+            }
+        }
+
+        u32 getBitsPerVoxelForPaletteSize(u32 paletteSize)
+        {
+            if (paletteSize <= 1)
+            {
+                return 0;
+            }
+            else if (paletteSize <= 2)
+            {
+                return 1;
+            }
+            else if (paletteSize <= 4)
+            {
+                return 2;
+            }
+            else if (paletteSize <= 16)
+            {
+                return 4;
+            }
+
+            return 8;
+        }
+    } // namespace
+
+    PaletteBrickHeader BrickPalette::getHeader() const
+    {
+        return PaletteBrickHeader::fromParts(getBitsPerVoxelForPaletteSize(this->size), this->size);
+    }
+
+    BrickPalette buildBrickPalette(const CombinedBrick& brick)
+    {
+        BrickPalette palette {};
+        palette.indices.fill(BrickPalette::NotInPalette);
+
+        forEachSolidVoxel(
+            brick,
+            [&](u32, u16 material)
+            {
+                if (palette.indices[material] == BrickPalette::NotInPalette)
+                {
+                    palette.indices[material]       = static_cast<u16>(palette.size);
+                    palette.materials[palette.size] = material;
+                    palette.size += 1;
+                }
+            });
+
+        // An entirely empty brick still carries one (unused) entry
+        if (palette.size == 0)
+        {
+            palette.size = 1;
+        }
+
+        return palette;
+    }
+
+    void encodePaletteBrick(const CombinedBrick& brick, const BrickPalette& palette, std::span<u32> out)
+    {
+        const PaletteBrickHeader header       = palette.getHeader();
+        const u32                bitsPerVoxel = header.getBitsPerVoxel();
+
+        assert::critical(
+            out.size() == header.getWordCount(),
+            "Tried to encode a palette brick of {} words into {} words",
+            header.getWordCount(),
+            out.size());
+
+        std::ranges::fill(out, 0u);
+
+        out[0] = header.data;
+
+        std::memcpy(&out[PALETTE_BRICK_BOOLEAN_WORD_OFFSET], brick.boolean_brick.data, sizeof(BooleanBrick));
+
+        for (u32 i = 0; i < palette.size; ++i)
+        {
+            out[PALETTE_BRICK_PALETTE_WORD_OFFSET + (i / 2)] |=
+                static_cast<u32>(palette.materials[i]) << (16 * (i % 2));
+        }
+
+        if (bitsPerVoxel == 0)
+        {
+            return;
+        }
+
+        const std::span<u32> indexWords = out.subspan(header.getIndexWordOffset());
+
+        forEachSolidVoxel(
+            brick,
+            [&](u32 linearIndex, u16 material)
+            {
+                const u32 bitOffset = linearIndex * bitsPerVoxel;
+
+                indexWords[bitOffset / 32] |= static_cast<u32>(palette.indices[material]) << (bitOffset % 32);
+            });
+    }
+
+    CombinedBrick decodePaletteBrick(std::span<const u32> in)
+    {
+        const PaletteBrickHeader header {in[0]};
+        const u32                bitsPerVoxel = header.getBitsPerVoxel();
+
+        assert::critical(
+            in.size() >= header.getWordCount(),
+            "Tried to decode a palette brick of {} words from {} words",
+            header.getWordCount(),
+            in.size());
+
+        CombinedBrick brick {};
+
+        std::memcpy(brick.boolean_brick.data, &in[PALETTE_BRICK_BOOLEAN_WORD_OFFSET], sizeof(BooleanBrick));
+
+        for (u8 x = 0; x < 8; ++x)
+        {
+            for (u8 y = 0; y < 8; ++y)
+            {
+                for (u8 z = 0; z < 8; ++z)
+                {
+                    const BrickLocalPosition bP {glm::u8vec3 {x, y, z}, UncheckedInDebugTag {}};
+
+                    if (!brick.boolean_brick.read(bP))
+                    {
+                        continue;
+                    }
+
+                    u32 paletteIndex = 0;
+
+                    if (bitsPerVoxel != 0)
+                    {
+                        const u32 bitOffset = (x + (8u * y) + (64u * z)) * bitsPerVoxel;
+                        const u32 word      = in[header.getIndexWordOffset() + (bitOffset / 32)];
+
+                        paletteIndex = (word >> (bitOffset % 32)) & ((1u << bitsPerVoxel) - 1u);
+                    }
+
+                    const u32 paletteWord = in[PALETTE_BRICK_PALETTE_WORD_OFFSET + (paletteIndex / 2)];
+
+                    brick.material_brick.write(bP, static_cast<u16>(paletteWord >> (16 * (paletteIndex % 2))));
+                }
+            }
+        }
+
+        return brick;
+    }
+} // namespace gfx::generators::voxel
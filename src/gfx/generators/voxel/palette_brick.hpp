@@ -0,0 +1,33 @@
+#pragma once
+
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/util.hpp"
+#include <array>
+#include <limits>
+#include <span>
+
+namespace gfx::generators::voxel
+{
+    /// The distinct materials used by a brick's solid voxels. Building one walks the whole brick, so it is built
+    /// once and then used both to size the encoding and to encode it
+    struct BrickPalette
+    {
+        static constexpr u16 NotInPalette = std::numeric_limits<u16>::max();
+
+        std::array<u16, 256> materials;
+        u32                  size;
+        // Indexed by material, NotInPalette if that material isn't used by a solid voxel
+        std::array<u16, 512> indices;
+
+        /// Header describing the smallest palette encoding of the brick
+        [[nodiscard]] PaletteBrickHeader getHeader() const;
+    };
+
+    [[nodiscard]] BrickPalette buildBrickPalette(const CombinedBrick&);
+
+    /// Writes exactly palette.getHeader().getWordCount() words, the palette must have been built from this brick
+    void encodePaletteBrick(const CombinedBrick&, const BrickPalette&, std::span<u32>);
+
+    [[nodiscard]] CombinedBrick decodePaletteBrick(std::span<const u32>);
+} // namespace gfx::generators::voxel
@@ -1,23 +1,36 @@
 #include "voxel_renderer.hpp"
 #include "gfx/camera.hpp"
 #include "gfx/core/renderer.hpp"
+#include "gfx/core/vulkan/frame_manager.hpp"
 #include "gfx/core/vulkan/pipeline_manager.hpp"
 #include "gfx/core/window.hpp"
+#include "gfx/generators/voxel/brick_kernels.hpp"
+#include "gfx/generators/voxel/brick_store.hpp"
 #include "gfx/generators/voxel/data_structures.hpp"
 #include "gfx/generators/voxel/emissive_integer_tree.hpp"
+#include "gfx/generators/voxel/emissive_light_extraction.hpp"
 #include "gfx/generators/voxel/light_influence_storage.hpp"
 #include "gfx/generators/voxel/material.hpp"
 #include "gfx/generators/voxel/shared_data_structures.slang"
 #include "gfx/shader_common/bindings.slang"
+#include "util/allocators/frame_arena.hpp"
 #include "util/allocators/range_allocator.hpp"
 #include "util/events.hpp"
 #include "util/logger.hpp"
 #include "util/timer.hpp"
 #include "util/util.hpp"
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstring>
+#include <glm/common.hpp>
 #include <glm/ext/vector_uint3_sized.hpp>
 #include <glm/geometric.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <limits>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
 #include <span>
 #include <tracy/Tracy.hpp>
 #include <type_traits>
@@ -28,9 +41,14 @@
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
-static constexpr u32 MaxChunks                          = 1u << 14u; // this can be extended
-static constexpr u32 AverageNonHomogenousBricksPerChunk = 192;
-static constexpr u32 BricksToAllocate                   = MaxChunks * AverageNonHomogenousBricksPerChunk;
+static constexpr u32  MaxChunks                          = 1u << 14u; // this can be extended
+static constexpr u32  AverageNonHomogenousBricksPerChunk = 192;
+static constexpr u32  BricksToAllocate                   = MaxChunks * AverageNonHomogenousBricksPerChunk;
+static constexpr u32  BrickPointersToAllocate            = BricksToAllocate * 2; // pointer slots are only 4 bytes
+static constexpr u32  AveragePaletteBrickWords           = 96; // a 4 bit palette brick is 89
+static constexpr u32  BrickWordsToAllocate               = BricksToAllocate * AveragePaletteBrickWords;
+static constexpr bool DeduplicateBricks                  = true;
+static constexpr u32  FrameArenaBytes                    = 1u << 20u; // grows itself if a frame needs more
 
 namespace gfx::generators::voxel
 {
@@ -57,7 +75,7 @@ namespace gfx::generators::voxel
             {
                 // ok well its a dense brick, but not of what we need
                 CombinedBrick workingBrick {};
-                workingBrick.fill(maybeThisBrickOffset.getMaterial());
+                fillCombinedBrick(workingBrick, maybeThisBrickOffset.getMaterial());
                 workingBrick.write(bP, static_cast<u16>(v));
 
                 const u16 newBrickPointer = nextBrickId;
@@ -89,7 +107,7 @@ namespace gfx::generators::voxel
                     {
                         const CombinedBrick& maybeCompactBrick = partiallyDenseBricks[partiallyDenseOffset._data];
 
-                        const CombinedBrickReadResult compactionResult = maybeCompactBrick.isCompact();
+                        const CombinedBrickReadResult compactionResult = isCombinedBrickCompact(maybeCompactBrick);
 
                         if (compactionResult.solid)
                         {
@@ -164,8 +182,9 @@ namespace gfx::generators::voxel
                   .blend_enable {vk::True},
                   .name {"Color Transfer Pipeline"},
               })}
-        , light_influence_storage {MaxVoxelLights}
-        , chunk_allocator {MaxChunks}
+        , light_influence_storage {MaxVoxelLights, MaxAggregateVoxelLights}
+        , should_update_all_chunk_lights {false}
+        , chunks {MaxChunks}
         , gpu_chunk_data{
               this->renderer,
               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
@@ -173,7 +192,13 @@ namespace gfx::generators::voxel
               MaxChunks,
               "Chunk Data",
               SBO_CHUNK_DATA}
-        , cpu_chunk_data {MaxChunks}
+        , live_chunk_ids{
+              this->renderer,
+              vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              MaxChunks,
+              "Live Chunk Ids",
+              SBO_LIVE_CHUNK_IDS}
         , chunk_hash_map{
               this->renderer,
               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
@@ -181,22 +206,25 @@ namespace gfx::generators::voxel
               chunkHashTableCapacity,
               "Chunk Hash Map",
               SBO_CHUNK_HASH_MAP}
-        , brick_allocator{BricksToAllocate, MaxChunks}
-        , combined_bricks{
+        , max_chunk_lod {0}
+        , brick_allocator{BrickPointersToAllocate, MaxChunks}
+        , brick_pointers{
               this->renderer,
               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
               vk::MemoryPropertyFlagBits::eDeviceLocal,
-              BricksToAllocate,
-              "Combined Bricks",
-              SBO_COMBINED_BRICKS}
+              BrickPointersToAllocate,
+              "Brick Pointers",
+              SBO_BRICK_POINTERS}
+        , brick_store {this->renderer, BricksToAllocate, BrickWordsToAllocate, DeduplicateBricks}
         , light_allocator {MaxVoxelLights}
         , lights{
               this->renderer,
               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
               vk::MemoryPropertyFlagBits::eDeviceLocal,
-              MaxVoxelLights,
+              MaxVoxelLights + MaxAggregateVoxelLights,
               "Voxel Lights",
               SBO_VOXEL_LIGHTS}
+        , has_warned_about_emissive_light_exhaustion {false}
         , face_hash_map{
               this->renderer,
               vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
@@ -205,6 +233,7 @@ namespace gfx::generators::voxel
               "Face Hash Map",
               SBO_FACE_HASH_MAP}
         , materials {generateMaterialBuffer(this->renderer)}
+        , frame_arena {gfx::core::vulkan::FramesInFlight, FrameArenaBytes}
     {}
 
     VoxelRenderer::~VoxelRenderer()
@@ -222,34 +251,64 @@ namespace gfx::generators::voxel
 
     VoxelRenderer::VoxelChunk VoxelRenderer::createVoxelChunk(ChunkLocation location)
     {
-        VoxelChunk newChunk = this->chunk_allocator.allocateOrPanic();
-        const u32  chunkId  = this->chunk_allocator.getValueOfHandle(newChunk);
+        VoxelChunk newChunk = this->reserveVoxelChunk();
+
+        this->commitVoxelChunk(newChunk, location);
+
+        return newChunk;
+    }
+
+    VoxelRenderer::VoxelChunk VoxelRenderer::reserveVoxelChunk()
+    {
+        std::expected<VoxelChunk, util::IndexAllocator::OutOfBlocks> maybeChunk = this->chunks.reserve();
+
+        if (!maybeChunk.has_value())
+        {
+            panic("Tried to allocate more than {} voxel chunks!", MaxChunks);
+        }
+
+        return std::move(*maybeChunk);
+    }
+
+    void VoxelRenderer::commitVoxelChunk(const VoxelChunk& newChunk, ChunkLocation location)
+    {
+        this->chunks.commit(newChunk, {});
+        const u32 chunkId = this->chunks.getSlotOfHandle(newChunk);
 
         this->gpu_chunk_data.write<&GpuChunkData::chunk_location>(chunkId, location);
         this->gpu_chunk_data.write<&GpuChunkData::offset>(chunkId, ~0u);
-        assert::critical(this->cpu_chunk_data[chunkId].brick_allocation.isNull(), "should be empty");
-        assert::critical(this->cpu_chunk_data[chunkId] == CpuChunkData {}, "should be default");
+        this->live_chunk_ids.write(this->chunks.getDenseIndexOfSlot(chunkId), chunkId);
 
         insertUniqueChunkHashTable(this->chunk_hash_map, location, {chunkId});
+        this->max_chunk_lod = std::max(this->max_chunk_lod, location.lod);
 
-        return newChunk;
+        // lights only mark the chunks they touch as dirty, so a new chunk must look for existing ones itself
+        this->updateChunkNearbyLights(chunkId);
+    }
+
+    void VoxelRenderer::cancelVoxelChunkReservation(VoxelChunk reserved)
+    {
+        this->chunks.cancelReservation(std::move(reserved));
     }
 
     void VoxelRenderer::destroyVoxelChunk(VoxelChunk c)
     {
-        const u32     chunkId         = this->chunk_allocator.getValueOfHandle(c);
+        const u32     chunkId         = this->chunks.getSlotOfHandle(c);
+        const u32     denseIndex      = this->chunks.getDenseIndexOfSlot(chunkId);
         GpuChunkData& oldGpuChunkData = this->gpu_chunk_data.modify(chunkId);
-        CpuChunkData& oldCpuChunkData = this->cpu_chunk_data[chunkId];
 
-        if (!oldCpuChunkData.brick_allocation.isNull())
+        this->releaseChunkBricks(this->chunks.getBySlot(chunkId).cpu_data);
+        this->releaseEmissiveLights(chunkId);
+        removeUniqueChunkHashTable(this->chunk_hash_map, oldGpuChunkData.chunk_location, {chunkId});
+        this->chunks.erase(std::move(c));
+
+        // the last live chunk was swapped into the hole
+        if (denseIndex < this->chunks.size())
         {
-            this->brick_allocator.free(std::move(oldCpuChunkData.brick_allocation));
+            this->live_chunk_ids.write(denseIndex, this->chunks.getDenseSlots()[denseIndex]);
         }
-        removeUniqueChunkHashTable(this->chunk_hash_map, oldGpuChunkData.chunk_location, {chunkId});
-        this->chunk_allocator.free(std::move(c));
 
         oldGpuChunkData = {};
-        oldCpuChunkData = {};
     }
 
     void VoxelRenderer::destroyVoxelLight(VoxelLight light)
@@ -290,49 +349,116 @@ namespace gfx::generators::voxel
         this->lights.write(lightId, gpuLight);
     }
 
-    void VoxelRenderer::preFrameUpdate()
+    std::vector<VoxelRenderer::VoxelLight>
+    VoxelRenderer::createVoxelLights(std::span<const GpuRaytracedLight> gpuLights)
     {
-        ZoneScoped;
+        std::vector<VoxelLight>                        newLights {};
+        std::vector<std::pair<u16, GpuRaytracedLight>> newLightsWithIds {};
+        newLights.reserve(gpuLights.size());
+        newLightsWithIds.reserve(gpuLights.size());
 
-        const bool haveAnyLightsChanged = this->light_influence_storage.pack();
+        for (const GpuRaytracedLight& gpuLight : gpuLights)
+        {
+            VoxelLight newLight = this->light_allocator.allocateOrPanic();
+
+            newLightsWithIds.push_back({this->light_allocator.getValueOfHandle(newLight), gpuLight});
+            newLights.push_back(std::move(newLight));
+        }
+
+        this->light_influence_storage.insert(newLightsWithIds);
+        this->writeLights(newLightsWithIds);
+
+        return newLights;
+    }
+
+    void VoxelRenderer::updateVoxelLights(std::span<const VoxelLightUpdate> updates)
+    {
+        std::vector<std::pair<u16, GpuRaytracedLight>> updatesWithIds {};
+        updatesWithIds.reserve(updates.size());
 
-        if (haveAnyLightsChanged)
+        for (const auto& [light, gpuLight] : updates)
         {
-            // util::Timer t {"generated light gpu uploads"};
+            updatesWithIds.push_back({this->light_allocator.getValueOfHandle(light), gpuLight});
+        }
 
-            this->chunk_allocator.iterateThroughAllocatedElements(
-                [this](u32 chunkId)
-                {
-                    std::vector<u16> polledLightIds =
-                        this->light_influence_storage.poll(this->gpu_chunk_data.read(chunkId).chunk_location);
+        this->light_influence_storage.update(updatesWithIds);
+        this->writeLights(updatesWithIds);
+    }
 
-                    std::ranges::sort(polledLightIds);
+    void VoxelRenderer::destroyVoxelLights(std::span<VoxelLight> lightsToDestroy)
+    {
+        std::vector<u16> lightIds {};
+        lightIds.reserve(lightsToDestroy.size());
 
-                    const GpuChunkData& readOnlyGpuChunkData = this->gpu_chunk_data.read(chunkId);
+        for (const VoxelLight& light : lightsToDestroy)
+        {
+            lightIds.push_back(this->light_allocator.getValueOfHandle(light));
+        }
 
-                    std::span<const u16> currentLightIds {
-                        readOnlyGpuChunkData.nearby_light_ids.data(),
-                        readOnlyGpuChunkData.nearby_light_ids.data() + readOnlyGpuChunkData.number_of_nearby_lights};
+        this->light_influence_storage.remove(lightIds);
 
-                    if (!std::ranges::equal(polledLightIds, currentLightIds))
-                    {
-                        GpuChunkData& partiallyCoherentGpuChunkData = this->gpu_chunk_data.modifyCoherentRangeSized(
-                            chunkId,
-                            offsetof(GpuChunkData, number_of_nearby_lights),
-                            sizeof(GpuChunkData::number_of_nearby_lights)
-                                + (polledLightIds.size()
-                                   * sizeof(decltype(partiallyCoherentGpuChunkData.nearby_light_ids)::value_type)));
-
-                        partiallyCoherentGpuChunkData.number_of_nearby_lights = static_cast<u16>(polledLightIds.size());
-                        std::memcpy(
-                            partiallyCoherentGpuChunkData.nearby_light_ids.data(),
-                            polledLightIds.data(),
-                            std::span<const u16> {polledLightIds}.size_bytes());
-                    }
-                });
+        if constexpr (CINNABAR_DEBUG_BUILD)
+        {
+            std::vector<std::pair<u16, GpuRaytracedLight>> poisonedLights {};
+            poisonedLights.reserve(lightIds.size());
+
+            for (const u16 lightId : lightIds)
+            {
+                GpuRaytracedLight poisoned = this->lights.read(lightId);
+                poisoned.color_and_power   = {1.0, 0.5, 0.5, 100000};
+                poisonedLights.push_back({lightId, poisoned});
+            }
+
+            this->writeLights(poisonedLights);
+        }
+
+        for (VoxelLight& light : lightsToDestroy)
+        {
+            this->light_allocator.free(std::move(light));
         }
+    }
+
+    void VoxelRenderer::setLightsPerChunk(u16 lightsPerChunk)
+    {
+        this->light_influence_storage.setLightsPerChunk(lightsPerChunk);
 
+        this->should_update_all_chunk_lights = true;
+    }
+
+    void VoxelRenderer::preFrameUpdate()
+    {
+        ZoneScoped;
+
+        this->frame_arena.beginFrame(this->renderer->getFrameNumber());
+
+        std::pmr::vector<std::pair<u16, GpuRaytracedLight>> changedAggregateLights =
+            this->light_influence_storage.updateAggregates(this->frame_arena.getResource());
+        this->writeLights(changedAggregateLights);
+
+        const std::pmr::vector<LightInfluenceStorage::DirtyRegion> dirtyLightRegions =
+            this->light_influence_storage.takeDirtyRegions(this->frame_arena.getResource());
+
+        if (this->should_update_all_chunk_lights)
+        {
+            for (const u32 chunkId : this->chunks.getDenseSlots())
+            {
+                this->updateChunkNearbyLights(chunkId);
+            }
+
+            this->should_update_all_chunk_lights = false;
+        }
+        else if (!dirtyLightRegions.empty())
+        {
+            // only chunks that a changed light used to or now does touch can have different nearby lights
+            for (u32 chunkId : this->findChunksInRegions(dirtyLightRegions))
+            {
+                this->updateChunkNearbyLights(chunkId);
+            }
+        }
+
+        this->brick_store.flushViaStager(this->renderer->getStager(), this->frame_arena.getResource());
         this->gpu_chunk_data.flushViaStager(this->renderer->getStager());
+        this->live_chunk_ids.flushViaStager(this->renderer->getStager());
         this->chunk_hash_map.flushViaStager(this->renderer->getStager());
         this->lights.flushViaStager(this->renderer->getStager());
     }
@@ -340,17 +466,14 @@ namespace gfx::generators::voxel
     void VoxelRenderer::setVoxelChunkData(
         const VoxelChunk& c, const BrickMap& compactBrickMap, std::span<const CombinedBrick> compactedBricks)
     {
-        const u32 chunkId = this->chunk_allocator.getValueOfHandle(c);
+        const u32 chunkId = this->chunks.getSlotOfHandle(c);
 
         GpuChunkData& partiallyCoherentGpuChunkData = this->gpu_chunk_data.modifyCoherentRangeOffsets(
             chunkId, offsetof(GpuChunkData, offset), offsetof(GpuChunkData, brick_map) + sizeof(BrickMap));
 
-        CpuChunkData& cpuChunkData = this->cpu_chunk_data[chunkId];
+        CpuChunkData& cpuChunkData = this->chunks.getBySlot(chunkId).cpu_data;
 
-        if (!cpuChunkData.brick_allocation.isNull())
-        {
-            this->brick_allocator.free(std::move(cpuChunkData.brick_allocation));
-        }
+        this->releaseChunkBricks(cpuChunkData);
 
         if (!compactedBricks.empty())
         {
@@ -373,13 +496,602 @@ namespace gfx::generators::voxel
                 partiallyCoherentGpuChunkData.offset);
         }
 
-        if (!compactedBricks.empty())
+        cpuChunkData.occupancy = ChunkOccupancy::fromBrickMap(compactBrickMap, compactedBricks);
+        cpuChunkData.brick_ids.reserve(compactedBricks.size());
+
+        for (const CombinedBrick& b : compactedBricks)
+        {
+            cpuChunkData.brick_ids.push_back(this->brick_store.insert(b));
+        }
+
+        this->uploadBrickPointers(cpuChunkData, 0, static_cast<u32>(cpuChunkData.brick_ids.size()));
+
+        static constexpr std::array<u16, 512> EveryBrick = []
+        {
+            std::array<u16, 512> everyBrick {};
+            std::iota(everyBrick.begin(), everyBrick.end(), u16 {0});
+
+            return everyBrick;
+        }();
+
+        this->refreshEmissiveLights(chunkId, compactBrickMap, EveryBrick);
+    }
+
+    void VoxelRenderer::editVoxels(const VoxelChunk& c, std::span<const std::pair<ChunkLocalPosition, Voxel>> edits)
+    {
+        ZoneScoped;
+
+        static constexpr u16 NoWorkingBrick = std::numeric_limits<u16>::max();
+
+        const u32       chunkId      = this->chunks.getSlotOfHandle(c);
+        CpuChunkData&   cpuChunkData = this->chunks.getBySlot(chunkId).cpu_data;
+        const BrickMap& oldBrickMap  = this->gpu_chunk_data.read(chunkId).brick_map;
+        BrickMap        newBrickMap  = oldBrickMap;
+
+        // Bricks in the store may be shared, so edits are made to private copies that are written back at the end
+        // Indexed the same way BrickMap is laid out in memory, [x][y][z]
+        std::array<u16, 512>       workingBrickIndices {};
+        std::vector<CombinedBrick> workingBricks {};
+        workingBrickIndices.fill(NoWorkingBrick);
+
+        for (const auto& [cP, v] : edits)
+        {
+            const auto [bC, bP]     = cP.split();
+            const u16 newVoxel      = std::to_underlying(v);
+            const u32 linearBrickId = (bC.x * 64u) + (bC.y * 8u) + bC.z;
+
+            const MaybeBrickOffsetOrMaterialId maybeThisBrickOffset = newBrickMap[bC.x][bC.y][bC.z];
+            u16&                               workingBrickIndex    = workingBrickIndices[linearBrickId];
+
+            if (workingBrickIndex == NoWorkingBrick)
+            {
+                if (maybeThisBrickOffset.isMaterial() && maybeThisBrickOffset.getMaterial() == newVoxel)
+                {
+                    continue;
+                }
+
+                workingBrickIndex       = static_cast<u16>(workingBricks.size());
+                CombinedBrick& newBrick = workingBricks.emplace_back();
+
+                if (maybeThisBrickOffset.isMaterial())
+                {
+                    fillCombinedBrick(newBrick, maybeThisBrickOffset.getMaterial());
+                }
+                else
+                {
+                    newBrick = this->brick_store.read(cpuChunkData.brick_ids[maybeThisBrickOffset._data]);
+                }
+            }
+
+            workingBricks[workingBrickIndex].write(bP, newVoxel);
+        }
+
+        std::vector<u16> dirtyBrickOffsets {};
+        std::vector<u16> editedBricks {};
+
+        for (u32 linearBrickId = 0; linearBrickId < 512; ++linearBrickId)
+        {
+            if (workingBrickIndices[linearBrickId] == NoWorkingBrick)
+            {
+                continue;
+            }
+
+            editedBricks.push_back(static_cast<u16>(linearBrickId));
+
+            const CombinedBrick&          workingBrick     = workingBricks[workingBrickIndices[linearBrickId]];
+            const CombinedBrickReadResult compactionResult = isCombinedBrickCompact(workingBrick);
+
+            const BrickCoordinate bC {
+                glm::u8vec3 {linearBrickId / 64, (linearBrickId / 8) % 8, linearBrickId % 8}, UncheckedInDebugTag {}};
+            MaybeBrickOffsetOrMaterialId& maybeThisBrickOffset = newBrickMap[bC.x][bC.y][bC.z];
+
+            if (compactionResult.solid)
+            {
+                cpuChunkData.occupancy.setBrickFromMaterial(bC, compactionResult.voxel);
+
+                if (maybeThisBrickOffset.isPointer())
+                {
+                    // Demote, the slot stays in the allocation and will be picked up by the next promotion
+                    const u16 brickOffset = maybeThisBrickOffset._data;
+
+                    this->brick_store.release(cpuChunkData.brick_ids[brickOffset]);
+                    cpuChunkData.brick_ids[brickOffset] = BrickStore::NullBrickId;
+                    cpuChunkData.free_brick_offsets.push_back(brickOffset);
+                }
+
+                maybeThisBrickOffset = MaybeBrickOffsetOrMaterialId::fromMaterial(compactionResult.voxel);
+
+                continue;
+            }
+
+            cpuChunkData.occupancy.setBrick(bC, ChunkOccupancy::getOctantsOfBrick(workingBrick.boolean_brick));
+
+            if (maybeThisBrickOffset.isPointer())
+            {
+                const u16 brickOffset     = maybeThisBrickOffset._data;
+                const u32 oldBrickPointer = this->brick_store.getGpuPointer(cpuChunkData.brick_ids[brickOffset]);
+
+                cpuChunkData.brick_ids[brickOffset] =
+                    this->brick_store.replace(cpuChunkData.brick_ids[brickOffset], workingBrick);
+
+                // Either copied on write or moved to fit a larger palette
+                if (this->brick_store.getGpuPointer(cpuChunkData.brick_ids[brickOffset]) != oldBrickPointer)
+                {
+                    dirtyBrickOffsets.push_back(brickOffset);
+                }
+            }
+            else
+            {
+                // Promote this homogeneous brick to a real one, reusing a previously demoted slot if we can
+                u16 newBrickOffset = 0;
+
+                if (!cpuChunkData.free_brick_offsets.empty())
+                {
+                    newBrickOffset = cpuChunkData.free_brick_offsets.back();
+                    cpuChunkData.free_brick_offsets.pop_back();
+                }
+                else
+                {
+                    newBrickOffset = static_cast<u16>(cpuChunkData.brick_ids.size());
+                    cpuChunkData.brick_ids.push_back(BrickStore::NullBrickId);
+                }
+
+                cpuChunkData.brick_ids[newBrickOffset] = this->brick_store.insert(workingBrick);
+                dirtyBrickOffsets.push_back(newBrickOffset);
+
+                maybeThisBrickOffset = MaybeBrickOffsetOrMaterialId::fromOffset(newBrickOffset);
+            }
+        }
+
+        this->refreshEmissiveLights(chunkId, newBrickMap, editedBricks);
+
+        const u32 allocatedSlots = cpuChunkData.brick_allocation.isNull()
+                                     ? 0
+                                     : this->brick_allocator.getSizeOfAllocation(cpuChunkData.brick_allocation);
+
+        if (cpuChunkData.brick_ids.size() > allocatedSlots)
+        {
+            // Out of room in the pointer table, move to a larger range. Leave some headroom so that continuous
+            // edits to the same chunk don't have to do this every time
+            const u32 neededSlots = static_cast<u32>(cpuChunkData.brick_ids.size());
+            const u32 newCapacity = std::max(neededSlots + (neededSlots / 4), neededSlots + 8);
+
+            if (!cpuChunkData.brick_allocation.isNull())
+            {
+                this->brick_allocator.free(std::move(cpuChunkData.brick_allocation));
+            }
+
+            cpuChunkData.brick_allocation = this->brick_allocator.allocate(newCapacity);
+
+            GpuChunkData& partiallyCoherentGpuChunkData = this->gpu_chunk_data.modifyCoherentRangeOffsets(
+                chunkId, offsetof(GpuChunkData, offset), offsetof(GpuChunkData, brick_map) + sizeof(BrickMap));
+
+            partiallyCoherentGpuChunkData.offset =
+                util::RangeAllocator::getOffsetofAllocation(cpuChunkData.brick_allocation);
+            partiallyCoherentGpuChunkData.brick_map = newBrickMap;
+
+            this->uploadBrickPointers(cpuChunkData, 0, neededSlots);
+
+            return;
+        }
+
+        std::ranges::sort(dirtyBrickOffsets);
+
+        // Upload contiguous runs of changed pointers together
+        for (usize runStart = 0; runStart < dirtyBrickOffsets.size();)
+        {
+            usize runEnd = runStart + 1;
+
+            while (runEnd < dirtyBrickOffsets.size()
+                   && dirtyBrickOffsets[runEnd] == dirtyBrickOffsets[runEnd - 1] + 1)
+            {
+                ++runEnd;
+            }
+
+            this->uploadBrickPointers(cpuChunkData, dirtyBrickOffsets[runStart], static_cast<u32>(runEnd - runStart));
+
+            runStart = runEnd;
+        }
+
+        // Same for the brick map entries that actually changed
+        const MaybeBrickOffsetOrMaterialId* oldEntries = &oldBrickMap[0][0][0];
+        const MaybeBrickOffsetOrMaterialId* newEntries = &newBrickMap[0][0][0];
+
+        for (u32 runStart = 0; runStart < 512;)
+        {
+            if (oldEntries[runStart]._data == newEntries[runStart]._data)
+            {
+                ++runStart;
+
+                continue;
+            }
+
+            u32 runEnd = runStart + 1;
+
+            while (runEnd < 512 && oldEntries[runEnd]._data != newEntries[runEnd]._data)
+            {
+                ++runEnd;
+            }
+
+            GpuChunkData& partiallyCoherentGpuChunkData = this->gpu_chunk_data.modifyCoherentRangeSized(
+                chunkId,
+                offsetof(GpuChunkData, brick_map) + (runStart * sizeof(MaybeBrickOffsetOrMaterialId)),
+                (runEnd - runStart) * sizeof(MaybeBrickOffsetOrMaterialId));
+
+            std::memcpy(
+                &partiallyCoherentGpuChunkData.brick_map[0][0][0] + runStart,
+                newEntries + runStart,
+                (runEnd - runStart) * sizeof(MaybeBrickOffsetOrMaterialId));
+
+            runStart = runEnd;
+        }
+    }
+
+    const ChunkOccupancy& VoxelRenderer::getChunkOccupancy(const VoxelChunk& c) const
+    {
+        return this->chunks.get(c).cpu_data.occupancy;
+    }
+
+    void VoxelRenderer::uploadBrickPointers(const CpuChunkData& cpuChunkData, u32 firstSlot, u32 numberOfSlots)
+    {
+        if (numberOfSlots == 0)
+        {
+            return;
+        }
+
+        const core::vulkan::BufferStager& stager = this->renderer->getStager();
+        const u32                         offset =
+            util::RangeAllocator::getOffsetofAllocation(cpuChunkData.brick_allocation) + firstSlot;
+
+        std::optional<core::vulkan::BufferStager::Reservation> maybeReservation =
+            stager.reserveTransfer(this->brick_pointers, offset, numberOfSlots);
+        std::vector<u32> fallbackPointers {};
+        std::span<u32>   gpuPointers {};
+
+        // written straight into staging memory unless the stager is full
+        if (maybeReservation.has_value())
+        {
+            gpuPointers = maybeReservation->getData<u32>();
+        }
+        else
+        {
+            fallbackPointers.resize(numberOfSlots);
+            gpuPointers = fallbackPointers;
+        }
+
+        for (u32 i = 0; i < numberOfSlots; ++i)
+        {
+            gpuPointers[i] = this->brick_store.getGpuPointer(cpuChunkData.brick_ids[firstSlot + i]);
+        }
+
+        if (maybeReservation.has_value())
+        {
+            stager.commit(std::move(*maybeReservation));
+        }
+        else
+        {
+            stager.enqueueTransfer(this->brick_pointers, offset, std::span<const u32> {fallbackPointers});
+        }
+    }
+
+    void VoxelRenderer::releaseChunkBricks(CpuChunkData& cpuChunkData)
+    {
+        for (const BrickStore::BrickId id : cpuChunkData.brick_ids)
+        {
+            if (id != BrickStore::NullBrickId)
+            {
+                this->brick_store.release(id);
+            }
+        }
+
+        if (!cpuChunkData.brick_allocation.isNull())
+        {
+            this->brick_allocator.free(std::move(cpuChunkData.brick_allocation));
+        }
+
+        cpuChunkData.brick_ids.clear();
+        cpuChunkData.free_brick_offsets.clear();
+    }
+
+    std::pmr::vector<u32>
+    VoxelRenderer::findChunksInRegions(std::span<const LightInfluenceStorage::DirtyRegion> regions)
+    {
+        struct CoordinateRange
+        {
+            glm::ivec3 minimum;
+            glm::ivec3 maximum;
+            u32        lod;
+        };
+
+        std::pmr::vector<CoordinateRange> ranges {this->frame_arena.getResource()};
+        u64                          numberOfCandidateLocations = 0;
+
+        for (const LightInfluenceStorage::DirtyRegion& r : regions)
+        {
+            for (u32 lod = 0; lod <= this->max_chunk_lod; ++lod)
+            {
+                // aligned coordinates of chunks at this lod are multiples of 2^lod
+                const f32 chunkWidth = static_cast<f32>(64u << lod);
+                const i32 step       = static_cast<i32>(1u << lod);
+
+                const glm::ivec3 minimum = static_cast<glm::ivec3>(glm::floor(r.minimum / chunkWidth)) * step;
+                const glm::ivec3 maximum = static_cast<glm::ivec3>(glm::floor(r.maximum / chunkWidth)) * step;
+
+                const glm::u64vec3 extent = static_cast<glm::u64vec3>((maximum - minimum) / step + 1);
+
+                numberOfCandidateLocations += extent.x * extent.y * extent.z;
+                ranges.push_back(CoordinateRange {.minimum {minimum}, .maximum {maximum}, .lod {lod}});
+            }
+        }
+
+        std::pmr::vector<u32> chunkIds {this->frame_arena.getResource()};
+
+        // Probing the hash map is only a win while the regions are small compared to the world
+        if (numberOfCandidateLocations >= this->chunks.size())
         {
-            this->renderer->getStager().enqueueTransfer(
-                this->combined_bricks,
-                partiallyCoherentGpuChunkData.offset,
-                {compactedBricks.data(), compactedBricks.size()});
+            chunkIds.assign(this->chunks.getDenseSlots().begin(), this->chunks.getDenseSlots().end());
+            std::ranges::sort(chunkIds);
+
+            return chunkIds;
         }
+
+        for (const CoordinateRange& r : ranges)
+        {
+            const i32 step = static_cast<i32>(1u << r.lod);
+
+            for (i32 x = r.minimum.x; x <= r.maximum.x; x += step)
+            {
+                for (i32 y = r.minimum.y; y <= r.maximum.y; y += step)
+                {
+                    for (i32 z = r.minimum.z; z <= r.maximum.z; z += step)
+                    {
+                        const ChunkLocation location {.aligned_chunk_coordinate {x, y, z}, .lod {r.lod}};
+
+                        const MaybeChunkID maybeChunkId = tryReadChunkHashTable(this->chunk_hash_map, location);
+
+                        if (maybeChunkId.isNull())
+                        {
+                            continue;
+                        }
+
+                        const ChunkLocation& foundLocation =
+                            this->gpu_chunk_data.read(maybeChunkId.maybe_chunk_id.chunk_id).chunk_location;
+
+                        // the table only stores hashes, so reject anything that merely collided
+                        if (foundLocation.aligned_chunk_coordinate == location.aligned_chunk_coordinate
+                            && foundLocation.lod == location.lod)
+                        {
+                            chunkIds.push_back(maybeChunkId.maybe_chunk_id.chunk_id);
+                        }
+                    }
+                }
+            }
+        }
+
+        std::ranges::sort(chunkIds);
+        const auto [first, last] = std::ranges::unique(chunkIds);
+        chunkIds.erase(first, last);
+
+        return chunkIds;
+    }
+
+    void VoxelRenderer::writeLights(std::span<std::pair<u16, GpuRaytracedLight>> lightsWithIds)
+    {
+        if (lightsWithIds.empty())
+        {
+            return;
+        }
+
+        // stable so that the last of several updates to the same light wins
+        std::ranges::stable_sort(lightsWithIds, {}, &std::pair<u16, GpuRaytracedLight>::first);
+
+        const u16 firstId      = lightsWithIds.front().first;
+        const u32 numberOfIds  = static_cast<u32>(lightsWithIds.back().first - firstId) + 1;
+        u32       numberOfRuns = 1;
+
+        for (usize i = 1; i < lightsWithIds.size(); ++i)
+        {
+            if (lightsWithIds[i].first != lightsWithIds[i - 1].first + 1)
+            {
+                numberOfRuns += 1;
+            }
+        }
+
+        // Ids are handed out lowest first so batches are usually dense, in which case re-uploading the few
+        // untouched lights in between is cheaper than a flush per run
+        if (numberOfRuns == 1 || numberOfIds <= lightsWithIds.size() * 2)
+        {
+            std::span<GpuRaytracedLight> range = this->lights.modify(firstId, numberOfIds);
+
+            for (const auto& [lightId, gpuLight] : lightsWithIds)
+            {
+                range[lightId - firstId] = gpuLight;
+            }
+
+            return;
+        }
+
+        usize runStart = 0;
+
+        for (usize i = 1; i <= lightsWithIds.size(); ++i)
+        {
+            if (i == lightsWithIds.size() || lightsWithIds[i].first != lightsWithIds[i - 1].first + 1)
+            {
+                std::span<GpuRaytracedLight> range =
+                    this->lights.modify(lightsWithIds[runStart].first, i - runStart);
+
+                for (usize j = runStart; j < i; ++j)
+                {
+                    range[j - runStart] = lightsWithIds[j].second;
+                }
+
+                runStart = i;
+            }
+        }
+    }
+
+    void VoxelRenderer::updateChunkNearbyLights(u32 chunkId)
+    {
+        // the polled ids are only needed until they are copied into the chunk
+        const util::FrameArena::Scope scratch {this->frame_arena};
+        const GpuChunkData&           readOnlyGpuChunkData = this->gpu_chunk_data.read(chunkId);
+
+        std::span<const u16> currentLightIds {
+            readOnlyGpuChunkData.nearby_light_ids.data(),
+            readOnlyGpuChunkData.nearby_light_ids.data() + readOnlyGpuChunkData.number_of_nearby_lights};
+
+        // already sorted by id, and capped to what fits in nearby_light_ids
+        const std::pmr::vector<u16> polledLightIds = this->light_influence_storage.poll(
+            readOnlyGpuChunkData.chunk_location, currentLightIds, scratch.getResource());
+
+        if (!std::ranges::equal(polledLightIds, currentLightIds))
+        {
+            // the count and the ids are not adjacent, the brick map sits between them
+            this->gpu_chunk_data.modify<&GpuChunkData::number_of_nearby_lights>(chunkId) =
+                static_cast<u16>(polledLightIds.size());
+
+            if (!polledLightIds.empty())
+            {
+                GpuChunkData& partiallyCoherentGpuChunkData = this->gpu_chunk_data.modifyCoherentRangeSized(
+                    chunkId,
+                    offsetof(GpuChunkData, nearby_light_ids),
+                    std::span<const u16> {polledLightIds}.size_bytes());
+
+                std::memcpy(
+                    partiallyCoherentGpuChunkData.nearby_light_ids.data(),
+                    polledLightIds.data(),
+                    std::span<const u16> {polledLightIds}.size_bytes());
+            }
+        }
+    }
+
+    void VoxelRenderer::refreshEmissiveLights(
+        u32 chunkId, const BrickMap& brickMap, std::span<const u16> linearBrickIndices)
+    {
+        if (linearBrickIndices.empty())
+        {
+            return;
+        }
+
+        std::vector<EmissiveBrickLight>& emissiveLights = this->chunks.getBySlot(chunkId).emissive_lights;
+        const CpuChunkData&              cpuChunkData   = this->chunks.getBySlot(chunkId).cpu_data;
+        const ChunkLocation              location       = this->gpu_chunk_data.read(chunkId).chunk_location;
+
+        // linearBrickIndices is sorted, pull out the lights of every brick being refreshed and compact the rest down
+        // over them. Every slot written to has already had its light moved out
+        std::vector<VoxelLight> staleLights {};
+        usize                   numberOfKeptLights = 0;
+
+        for (usize i = 0; i < emissiveLights.size(); ++i)
+        {
+            if (std::ranges::binary_search(linearBrickIndices, emissiveLights[i].linear_brick))
+            {
+                staleLights.push_back(std::move(emissiveLights[i].light));
+            }
+            else
+            {
+                if (numberOfKeptLights != i)
+                {
+                    emissiveLights[numberOfKeptLights] = std::move(emissiveLights[i]);
+                }
+
+                numberOfKeptLights += 1;
+            }
+        }
+
+        emissiveLights.erase(emissiveLights.begin() + static_cast<isize>(numberOfKeptLights), emissiveLights.end());
+
+        std::vector<EmissiveCluster>                   clusters {};
+        std::vector<std::pair<u16, GpuRaytracedLight>> newLightsWithIds {};
+        std::vector<std::pair<u16, GpuRaytracedLight>> reusedLightsWithIds {};
+
+        for (const u16 linearBrick : linearBrickIndices)
+        {
+            const BrickCoordinate bC {
+                glm::u8vec3 {linearBrick / 64, (linearBrick / 8) % 8, linearBrick % 8}, UncheckedInDebugTag {}};
+            const MaybeBrickOffsetOrMaterialId entry = brickMap[bC.x][bC.y][bC.z];
+
+            clusters.clear();
+
+            if (entry.isMaterial())
+            {
+                clusterEmissiveVoxelsInSolidBrick(static_cast<Voxel>(entry.getMaterial()), bC, clusters);
+            }
+            else if (entry.isPointer())
+            {
+                clusterEmissiveVoxelsInBrick(this->brick_store.read(cpuChunkData.brick_ids[entry._data]), bC, clusters);
+            }
+
+            for (const EmissiveCluster& cluster : clusters)
+            {
+                const GpuRaytracedLight gpuLight = makeLightFromEmissiveCluster(cluster, location);
+
+                // Most edits leave the number of clusters unchanged, so move an old light rather than replacing it
+                if (!staleLights.empty())
+                {
+                    VoxelLight light = std::move(staleLights.back());
+                    staleLights.pop_back();
+
+                    reusedLightsWithIds.push_back({this->light_allocator.getValueOfHandle(light), gpuLight});
+                    emissiveLights.push_back(
+                        EmissiveBrickLight {.linear_brick {linearBrick}, .light {std::move(light)}});
+
+                    continue;
+                }
+
+                auto maybeLight = this->light_allocator.allocate();
+
+                if (!maybeLight.has_value())
+                {
+                    if (!this->has_warned_about_emissive_light_exhaustion)
+                    {
+                        log::warn("Out of voxel lights, some emissive voxels will not cast light");
+
+                        this->has_warned_about_emissive_light_exhaustion = true;
+                    }
+
+                    break;
+                }
+
+                newLightsWithIds.push_back({this->light_allocator.getValueOfHandle(*maybeLight), gpuLight});
+                emissiveLights.push_back(
+                    EmissiveBrickLight {.linear_brick {linearBrick}, .light {std::move(*maybeLight)}});
+            }
+        }
+
+        std::ranges::sort(emissiveLights, {}, &EmissiveBrickLight::linear_brick);
+
+        if (!staleLights.empty())
+        {
+            this->destroyVoxelLights(staleLights);
+        }
+
+        this->light_influence_storage.update(reusedLightsWithIds);
+        this->light_influence_storage.insert(newLightsWithIds);
+        this->writeLights(reusedLightsWithIds);
+        this->writeLights(newLightsWithIds);
+    }
+
+    void VoxelRenderer::releaseEmissiveLights(u32 chunkId)
+    {
+        std::vector<EmissiveBrickLight>& emissiveLights = this->chunks.getBySlot(chunkId).emissive_lights;
+
+        if (emissiveLights.empty())
+        {
+            return;
+        }
+
+        std::vector<VoxelLight> lightsToDestroy {};
+        lightsToDestroy.reserve(emissiveLights.size());
+
+        for (EmissiveBrickLight& l : emissiveLights)
+        {
+            lightsToDestroy.push_back(std::move(l.light));
+        }
+
+        emissiveLights.clear();
+
+        this->destroyVoxelLights(lightsToDestroy);
     }
 
     void VoxelRenderer::recordFaceNormalizer(vk::CommandBuffer commandBuffer)
@@ -405,7 +1117,7 @@ namespace gfx::generators::voxel
             vk::PipelineBindPoint::eGraphics,
             this->renderer->getPipelineManager()->getPipeline(this->prepass_pipeline));
 
-        commandBuffer.draw(36 * this->chunk_allocator.getUpperBoundOnAllocatedElements(), 1, 0, 0);
+        commandBuffer.draw(36 * this->chunks.size(), 1, 0, 0);
     }
 
     void VoxelRenderer::recordColorCalculation(vk::CommandBuffer commandBuffer)
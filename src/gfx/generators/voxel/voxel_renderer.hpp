@@ -1,6 +1,7 @@
 #pragma once
 
 #include "data_structures.hpp"
+#include "brick_store.hpp"
 #include "emissive_integer_tree.hpp"
 #include "gfx/camera.hpp"
 #include "gfx/core/vulkan/buffer.hpp"
@@ -8,8 +9,11 @@
 #include "gfx/generators/voxel/light_influence_storage.hpp"
 #include "gfx/generators/voxel/material.hpp"
 #include "gfx/generators/voxel/shared_data_structures.slang"
+#include "util/allocators/concurrent_index_allocator.hpp"
+#include "util/allocators/frame_arena.hpp"
 #include "util/allocators/opaque_integer_handle_allocator.hpp"
 #include "util/allocators/range_allocator.hpp"
+#include "util/allocators/slot_map.hpp"
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 
@@ -21,6 +25,8 @@ namespace gfx::core
 namespace gfx::generators::voxel
 {
     static constexpr u16 MaxVoxelLights = 8192;
+    // Stored after the regular lights, see LightInfluenceStorage
+    static constexpr u16 MaxAggregateVoxelLights = 4096;
 
     std::pair<BrickMap, std::vector<CombinedBrick>>
         createDenseChunk(std::span<const std::pair<ChunkLocalPosition, Voxel>>);
@@ -31,7 +37,7 @@ namespace gfx::generators::voxel
     class VoxelRenderer
     {
     public:
-        using VoxelChunk = util::OpaqueHandle<"Voxel Chunk", u16>;
+        using VoxelChunk = util::OpaqueHandle<"Voxel Chunk", u32>;
         using VoxelLight = util::OpaqueHandle<"Voxel Light", u16>;
         static_assert(VoxelLight::MaxValidElement > MaxVoxelLights);
 
@@ -40,6 +46,7 @@ namespace gfx::generators::voxel
 
         using UniqueVoxelChunk = util::UniqueOpaqueHandle<VoxelChunk, &VoxelRenderer::destroyVoxelChunk>;
         using UniqueVoxelLight = util::UniqueOpaqueHandle<VoxelLight, &VoxelRenderer::destroyVoxelLight>;
+        using VoxelLightUpdate = std::pair<const VoxelLight&, GpuRaytracedLight>;
     public:
 
         explicit VoxelRenderer(const core::Renderer*);
@@ -52,12 +59,32 @@ namespace gfx::generators::voxel
 
         [[nodiscard]] UniqueVoxelChunk createVoxelChunkUnique(ChunkLocation);
         [[nodiscard]] VoxelChunk       createVoxelChunk(ChunkLocation);
+        /// Thread safe, lets worker threads hand out chunk handles while the renderer's thread keeps rendering.
+        /// The handle can not be used until it is passed to commitVoxelChunk or cancelVoxelChunkReservation
+        [[nodiscard]] VoxelChunk reserveVoxelChunk();
+        void                     commitVoxelChunk(const VoxelChunk&, ChunkLocation);
+        void                     cancelVoxelChunkReservation(VoxelChunk);
         void setVoxelChunkData(const VoxelChunk&, const BrickMap&, std::span<const CombinedBrick>);
+        /// Writes individual voxels into an existing chunk. Only the bricks and brick map entries that actually
+        /// change are uploaded, so the cost scales with the number of edited bricks rather than the chunk
+        void editVoxels(const VoxelChunk&, std::span<const std::pair<ChunkLocalPosition, Voxel>>);
+        /// Kept in sync with every write to the chunk, for cpu side empty space skipping
+        [[nodiscard]] const ChunkOccupancy& getChunkOccupancy(const VoxelChunk&) const;
 
         [[nodiscard]] UniqueVoxelLight createVoxelLightUnique(GpuRaytracedLight);
         [[nodiscard]] VoxelLight       createVoxelLight(GpuRaytracedLight);
         void                           updateVoxelLight(const VoxelLight&, GpuRaytracedLight);
 
+        /// Batched light changes, the spatial index is updated in bulk and the gpu copy is flushed in as few
+        /// ranges as possible rather than one per light
+        [[nodiscard]] std::vector<VoxelLight> createVoxelLights(std::span<const GpuRaytracedLight>);
+        void updateVoxelLights(std::span<const VoxelLightUpdate>);
+        /// Takes ownership of every handle in the span, leaving them null
+        void destroyVoxelLights(std::span<VoxelLight>);
+
+        /// Caps how many lights each chunk considers, the most important ones are kept. Takes effect next frame
+        void setLightsPerChunk(u16);
+
         void preFrameUpdate();
         void recordFaceNormalizer(vk::CommandBuffer);
         void recordPrepass(vk::CommandBuffer, const Camera&);
@@ -65,6 +92,30 @@ namespace gfx::generators::voxel
         void recordColorTransfer(vk::CommandBuffer);
 
     private:
+        void uploadBrickPointers(const CpuChunkData&, u32 firstSlot, u32 numberOfSlots);
+        void releaseChunkBricks(CpuChunkData&);
+        // returns the sorted ids of every live chunk that may intersect one of the regions
+        [[nodiscard]] std::pmr::vector<u32>
+            findChunksInRegions(std::span<const LightInfluenceStorage::DirtyRegion>);
+        void                           updateChunkNearbyLights(u32 chunkId);
+        void                           writeLights(std::span<std::pair<u16, GpuRaytracedLight>>);
+        // Reclusters the emissive voxels of the given bricks (linear [x][y][z] indices) and replaces their lights
+        void refreshEmissiveLights(u32 chunkId, const BrickMap&, std::span<const u16> linearBrickIndices);
+        void releaseEmissiveLights(u32 chunkId);
+
+        struct EmissiveBrickLight
+        {
+            u16        linear_brick;
+            VoxelLight light;
+        };
+
+        struct ChunkState
+        {
+            CpuChunkData                    cpu_data;
+            // Lights extracted from the chunk's emissive voxels
+            std::vector<EmissiveBrickLight> emissive_lights;
+        };
+
         const core::Renderer*                        renderer;
         gfx::core::vulkan::PipelineManager::Pipeline prepass_pipeline;
         gfx::core::vulkan::PipelineManager::Pipeline face_normalizer_pipeline;
@@ -72,19 +123,29 @@ namespace gfx::generators::voxel
         gfx::core::vulkan::PipelineManager::Pipeline color_transfer_pipeline;
 
         LightInfluenceStorage light_influence_storage;
+        bool                  should_update_all_chunk_lights;
 
-        util::OpaqueHandleAllocator<VoxelChunk>              chunk_allocator;
-        gfx::core::vulkan::CpuCachedBuffer<GpuChunkData>     gpu_chunk_data;
-        std::vector<CpuChunkData>                            cpu_chunk_data;
-        gfx::core::vulkan::CpuCachedBuffer<ChunkHashMapNode> chunk_hash_map;
+        // Chunk ids are the slots of this map, they index gpu_chunk_data and are what the hash map stores
+        util::SlotMap<VoxelChunk, ChunkState, util::ConcurrentIndexAllocator> chunks;
+        gfx::core::vulkan::CpuCachedBuffer<GpuChunkData>                      gpu_chunk_data;
+        // Mirror of chunks.getDenseSlots(), the prepass draws one box per entry
+        gfx::core::vulkan::CpuCachedBuffer<u32>                               live_chunk_ids;
+        gfx::core::vulkan::CpuCachedBuffer<ChunkHashMapNode>                  chunk_hash_map;
+        u32                                                                   max_chunk_lod;
 
-        util::RangeAllocator                            brick_allocator;
-        gfx::core::vulkan::GpuOnlyBuffer<CombinedBrick> combined_bricks;
+        // Per chunk ranges of the brick pointer table, each slot holds an id in brick_store
+        util::RangeAllocator                  brick_allocator;
+        gfx::core::vulkan::GpuOnlyBuffer<u32> brick_pointers;
+        BrickStore                            brick_store;
 
         util::OpaqueHandleAllocator<VoxelLight>               light_allocator;
         gfx::core::vulkan::CpuCachedBuffer<GpuRaytracedLight> lights;
+        bool                                                  has_warned_about_emissive_light_exhaustion;
 
         gfx::core::vulkan::GpuOnlyBuffer<GpuColorHashMapNode> face_hash_map;
         gfx::core::vulkan::WriteOnlyBuffer<PBRVoxelMaterial>  materials;
+
+        // Scratch space for per frame temporaries, reset in preFrameUpdate
+        util::FrameArena frame_arena;
     };
 } // namespace gfx::generators::voxel
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "temporary_game_state.hpp"
 #include "game/game.hpp"
 #include "gfx/core/window.hpp"
+#include "gfx/generators/voxel/chunk_generation_service.hpp"
 #include "gfx/generators/voxel/generator.hpp"
 #include "tracy/Tracy.hpp"
 
@@ -34,13 +35,30 @@ TemporaryGameState::TemporaryGameState(game::Game* game_)
         gfx::generators::voxel::ChunkLocation {.aligned_chunk_coordinate {0, 0, 0}, .lod {1}},
     });
 
+    gfx::generators::voxel::ChunkGenerationService generationService {&wg};
+    generationService.setPriorityOrigin(this->camera.getPosition());
+
+    std::vector<std::pair<gfx::generators::voxel::ChunkLocation, gfx::generators::voxel::ChunkGenerationService::Request>>
+        requests {};
+
     for (const auto& location : locations)
     {
-        auto chunk = this->voxel_renderer.createVoxelChunkUnique(location);
+        requests.push_back({location, generationService.enqueue(location)});
+    }
+
+    for (auto& [location, request] : requests)
+    {
+        std::optional<gfx::generators::voxel::GeneratedChunk> maybeGenerated = request.future.get();
+
+        // Cancelled or entirely air, either way there's nothing to allocate
+        if (!maybeGenerated.has_value() || maybeGenerated->is_empty)
+        {
+            continue;
+        }
 
-        const auto [brickMap, bricks] = wg.generateChunkPreDense(location);
+        auto chunk = this->voxel_renderer.createVoxelChunkUnique(location);
 
-        this->voxel_renderer.setVoxelChunkData(chunk, brickMap, bricks);
+        this->voxel_renderer.setVoxelChunkData(chunk, maybeGenerated->brick_map, maybeGenerated->bricks);
 
         this->chunks.push_back(std::move(chunk));
     }
@@ -140,15 +158,20 @@ game::Game::GameStateUpdateResult TemporaryGameState::update(game::Game::GameSta
     // timer.stamp("dump");
     const f32 height = 23.2f + (14.2f * std::sin(this->game->getRenderer()->getTimeAlive()));
 
+    std::vector<gfx::generators::voxel::VoxelRenderer::VoxelLightUpdate> lightUpdates {};
+    lightUpdates.reserve(this->lights.size());
+
     for (usize i = 0; i < this->lights.size(); ++i)
     {
-        this->voxel_renderer.updateVoxelLight(
+        lightUpdates.emplace_back(
             lights[i],
             gfx::generators::voxel::GpuRaytracedLight {
                 .position_and_half_intensity_distance {(25 * i) + 16.3, height, (200 * (i / 2)) + 91.23, 8},
                 .color_and_power {1.0, 1.0, 1.0, 16.0}});
     }
 
+    this->voxel_renderer.updateVoxelLights(lightUpdates);
+
     util::TimestampStamper stamper;
 
     const f32  deltaTime        = updateArgs.delta_time;
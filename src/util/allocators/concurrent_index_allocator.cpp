@@ -0,0 +1,90 @@
+#include "concurrent_index_allocator.hpp"
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace util
+{
+    namespace
+    {
+        // Shared by every allocator, it is only a starting point for the search
+        thread_local u32 lastUsedWord = // NOLINT
+            static_cast<u32>(std::hash<std::thread::id> {}(std::this_thread::get_id()));
+    } // namespace
+
+    ConcurrentIndexAllocator::ConcurrentIndexAllocator(IndexType blocks)
+        : free_bits {std::make_unique<std::atomic<u64>[]>(std::max<IndexType>(1, (blocks + 63) / 64))}
+        , number_of_words {std::max<IndexType>(1, (blocks + 63) / 64)}
+        , max_number_of_blocks {blocks}
+        , number_allocated {0}
+        , high_water_mark {0}
+    {
+        for (IndexType word = 0; word < this->number_of_words; ++word)
+        {
+            const IndexType blocksInWord = std::min<IndexType>(64, blocks - std::min(blocks, word * 64));
+
+            this->free_bits[word].store(
+                blocksInWord == 64 ? ~u64 {0} : (u64 {1} << blocksInWord) - 1, std::memory_order_relaxed);
+        }
+    }
+
+    std::expected<ConcurrentIndexAllocator::IndexType, ConcurrentIndexAllocator::OutOfBlocks>
+    ConcurrentIndexAllocator::allocate()
+    {
+        // Claiming a block from the count first means a free bit is guaranteed to exist for us, the scan below
+        // only has to find it
+        if (this->number_allocated.fetch_add(1, std::memory_order_relaxed) >= this->max_number_of_blocks)
+        {
+            this->number_allocated.fetch_sub(1, std::memory_order_relaxed);
+
+            return std::unexpected(OutOfBlocks {});
+        }
+
+        IndexType word = lastUsedWord % this->number_of_words;
+
+        while (true)
+        {
+            std::atomic<u64>& bits = this->free_bits[word];
+            u64               free = bits.load(std::memory_order_relaxed);
+
+            while (free != 0)
+            {
+                if (bits.compare_exchange_weak(free, free & (free - 1), std::memory_order_acquire))
+                {
+                    const IndexType newBlock         = (word * 64) + static_cast<IndexType>(std::countr_zero(free));
+                    IndexType       oldHighWaterMark = this->high_water_mark.load(std::memory_order_relaxed);
+
+                    while (oldHighWaterMark < newBlock + 1
+                           && !this->high_water_mark.compare_exchange_weak(
+                               oldHighWaterMark, newBlock + 1, std::memory_order_relaxed))
+                    {}
+
+                    lastUsedWord = word;
+
+                    return newBlock;
+                }
+            }
+
+            word = word + 1 == this->number_of_words ? 0 : word + 1;
+        }
+    }
+
+    void ConcurrentIndexAllocator::free(IndexType blockToFree)
+    {
+        if (blockToFree >= this->max_number_of_blocks)
+        {
+            throw FreeOfUntrackedValue {};
+        }
+
+        const u64 bit      = u64 {1} << (blockToFree % 64);
+        const u64 oldValue = this->free_bits[blockToFree / 64].fetch_or(bit, std::memory_order_release);
+
+        if ((oldValue & bit) != 0)
+        {
+            throw DoubleFree {};
+        }
+
+        this->number_allocated.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+} // namespace util
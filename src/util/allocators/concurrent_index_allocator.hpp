@@ -0,0 +1,105 @@
+#pragma once
+
+#include "index_allocator.hpp"
+#include "util/logger.hpp"
+#include "util/util.hpp"
+#include <atomic>
+#include <bit>
+#include <expected>
+#include <memory>
+#include <source_location>
+
+namespace util
+{
+    /// Lock free version of IndexAllocator that any thread may allocate from and free to.
+    /// Free blocks are bits in an array of atomic words, each thread starts searching from the word it last
+    /// allocated from so that threads mostly contend on different cache lines.
+    /// Unlike IndexAllocator there is no ordering guarantee on which free index is returned and the capacity is
+    /// fixed at construction.
+    class ConcurrentIndexAllocator
+    {
+    public:
+        using IndexType            = IndexAllocator::IndexType;
+        using OutOfBlocks          = IndexAllocator::OutOfBlocks;
+        using FreeOfUntrackedValue = IndexAllocator::FreeOfUntrackedValue;
+        using DoubleFree           = IndexAllocator::DoubleFree;
+
+    public:
+        // Creates a new ConcurrentIndexAllocator that can allocate blocks at indicies in the range [0, blocks)
+        explicit ConcurrentIndexAllocator(IndexType blocks);
+        ~ConcurrentIndexAllocator() = default;
+
+        ConcurrentIndexAllocator(const ConcurrentIndexAllocator&)             = delete;
+        ConcurrentIndexAllocator(ConcurrentIndexAllocator&&)                  = delete;
+        ConcurrentIndexAllocator& operator= (const ConcurrentIndexAllocator&) = delete;
+        ConcurrentIndexAllocator& operator= (ConcurrentIndexAllocator&&)      = delete;
+
+        [[nodiscard]] u32 getNumberAllocated() const
+        {
+            return this->number_allocated.load(std::memory_order_relaxed);
+        }
+        [[nodiscard]] f32 getPercentAllocated() const
+        {
+            return static_cast<f32>(this->getNumberAllocated()) / static_cast<f32>(this->max_number_of_blocks);
+        }
+
+        IndexType allocateOrPanic(std::source_location loc = std::source_location::current())
+        {
+            std::expected<IndexType, OutOfBlocks> maybeNewAllocation = this->allocate();
+
+            if (!maybeNewAllocation.has_value())
+            {
+                panic<>("util::ConcurrentIndexAllocator::allocateOrPanic failed!", loc);
+            }
+
+            return *maybeNewAllocation;
+        }
+
+        std::expected<IndexType, OutOfBlocks> allocate();
+        void                                  free(IndexType);
+
+        /// Only a consistent view if no other thread is allocating or freeing
+        void iterateThroughAllocatedElements(std::invocable<IndexType> auto func) const
+        {
+            const IndexType upperBound    = this->getUpperBoundOnAllocatedElements();
+            const IndexType numberOfWords = (upperBound + 63) / 64;
+
+            for (IndexType word = 0; word < numberOfWords; ++word)
+            {
+                u64 alive = ~this->free_bits[word].load(std::memory_order_acquire);
+
+                if (word == numberOfWords - 1 && upperBound % 64 != 0)
+                {
+                    alive &= (u64 {1} << (upperBound % 64)) - 1;
+                }
+
+                while (alive != 0)
+                {
+                    func(static_cast<IndexType>((word * 64) + static_cast<IndexType>(std::countr_zero(alive))));
+
+                    alive &= alive - 1;
+                }
+            }
+        }
+
+        [[nodiscard]] bool isElementAlive(IndexType index) const
+        {
+            return index < this->max_number_of_blocks
+                && (this->free_bits[index / 64].load(std::memory_order_acquire) & (u64 {1} << (index % 64))) == 0;
+        }
+
+        /// One past the highest index ever handed out, this never shrinks
+        [[nodiscard]] IndexType getUpperBoundOnAllocatedElements() const
+        {
+            return this->high_water_mark.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // One bit per block, set if free. Padding bits past max_number_of_blocks are never set
+        std::unique_ptr<std::atomic<u64>[]> free_bits;
+        IndexType                           number_of_words;
+        IndexType                           max_number_of_blocks;
+        std::atomic<IndexType>              number_allocated;
+        std::atomic<IndexType>              high_water_mark;
+    };
+} // namespace util
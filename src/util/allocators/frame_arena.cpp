@@ -0,0 +1,140 @@
+#include "frame_arena.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <new>
+
+namespace util
+{
+    FrameArena::FrameArena(u32 framesInFlight, usize initialBytesPerFrame)
+        : current_region {0}
+        , last_frame_number {0}
+        , has_begun_frame {false}
+    {
+        assert::critical(framesInFlight > 0, "FrameArena needs at least one region");
+
+        this->regions.reserve(framesInFlight);
+
+        for (u32 i = 0; i < framesInFlight; ++i)
+        {
+            this->regions.push_back(std::make_unique<Region>(initialBytesPerFrame));
+        }
+    }
+
+    void FrameArena::beginFrame(u32 frameNumber)
+    {
+        if (this->has_begun_frame && frameNumber == this->last_frame_number)
+        {
+            return;
+        }
+
+        this->has_begun_frame   = true;
+        this->last_frame_number = frameNumber;
+        this->current_region    = frameNumber % static_cast<u32>(this->regions.size());
+
+        this->regions[this->current_region]->reset();
+    }
+
+    std::pmr::memory_resource* FrameArena::getResource()
+    {
+        return this->regions[this->current_region].get();
+    }
+
+    FrameArena::Marker FrameArena::mark() const
+    {
+        return this->regions[this->current_region]->mark();
+    }
+
+    void FrameArena::rewind(Marker marker)
+    {
+        this->regions[this->current_region]->rewind(marker);
+    }
+
+    FrameArena::Region::Region(usize capacity_)
+        : block {std::make_unique<std::byte[]>(capacity_)}
+        , capacity {capacity_}
+        , offset {0}
+        , overflow_bytes_in_use {0}
+        , peak_bytes_in_use {0}
+    {}
+
+    FrameArena::Region::~Region()
+    {
+        this->freeOverflowAllocations(0);
+    }
+
+    void FrameArena::Region::reset()
+    {
+        this->freeOverflowAllocations(0);
+
+        if (this->peak_bytes_in_use > this->capacity)
+        {
+            this->capacity = std::bit_ceil(this->peak_bytes_in_use);
+            this->block    = std::make_unique<std::byte[]>(this->capacity);
+
+            log::debug("FrameArena region grown to {} bytes", this->capacity);
+        }
+
+        this->offset            = 0;
+        this->peak_bytes_in_use = 0;
+    }
+
+    FrameArena::Marker FrameArena::Region::mark() const
+    {
+        return Marker {.offset {this->offset}, .number_of_overflow_allocations {this->overflow_allocations.size()}};
+    }
+
+    void FrameArena::Region::rewind(Marker marker)
+    {
+        assert::critical(
+            marker.offset <= this->offset
+                && marker.number_of_overflow_allocations <= this->overflow_allocations.size(),
+            "FrameArena rewound to a marker from a different frame");
+
+        this->offset = marker.offset;
+        this->freeOverflowAllocations(marker.number_of_overflow_allocations);
+    }
+
+    void* FrameArena::Region::do_allocate(usize bytes, usize alignment)
+    {
+        const std::uintptr_t base    = reinterpret_cast<std::uintptr_t>(this->block.get());
+        const std::uintptr_t aligned = (base + this->offset + alignment - 1) & ~(alignment - 1);
+        const usize          newEnd  = (aligned - base) + bytes;
+
+        if (newEnd <= this->capacity)
+        {
+            this->offset = newEnd;
+
+            return reinterpret_cast<void*>(aligned);
+        }
+
+        void* const memory = ::operator new (bytes, std::align_val_t {alignment});
+        this->overflow_allocations.push_back(
+            OverflowAllocation {.memory {memory}, .bytes {bytes}, .alignment {alignment}});
+
+        // Remembered so that the next reset() grows the block enough to have avoided this
+        this->overflow_bytes_in_use += bytes + alignment;
+        this->peak_bytes_in_use = std::max(this->peak_bytes_in_use, this->offset + this->overflow_bytes_in_use);
+
+        return memory;
+    }
+
+    bool FrameArena::Region::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+    {
+        return this == &other;
+    }
+
+    void FrameArena::Region::freeOverflowAllocations(usize numberToKeep)
+    {
+        while (this->overflow_allocations.size() > numberToKeep)
+        {
+            const OverflowAllocation& a = this->overflow_allocations.back();
+
+            ::operator delete (a.memory, a.bytes, std::align_val_t {a.alignment});
+            this->overflow_bytes_in_use -= a.bytes + a.alignment;
+
+            this->overflow_allocations.pop_back();
+        }
+    }
+} // namespace util
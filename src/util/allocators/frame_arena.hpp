@@ -0,0 +1,116 @@
+#pragma once
+
+#include "util/util.hpp"
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace util
+{
+    /// Bump allocator for scratch data that lives no longer than a frame, usable through std::pmr containers.
+    /// There is one region per frame in flight and beginFrame() only resets the region that was last used that many
+    /// frames ago, so memory handed out stays valid for as long as its frame can still be in flight.
+    /// A region that runs out falls back to the heap for the rest of the frame and is grown to fit on its next
+    /// reset, so once the sizes settle frames stop touching the heap entirely.
+    class FrameArena
+    {
+    public:
+        /// Position in the current region, see Scope
+        struct Marker
+        {
+            usize offset;
+            usize number_of_overflow_allocations;
+        };
+
+        /// Releases everything allocated from the arena during its lifetime when it is destroyed.
+        /// For temporaries of loops that would otherwise pile up over the frame, the Scope must outlive every
+        /// container allocated inside it.
+        class Scope
+        {
+        public:
+            explicit Scope(FrameArena& arena_)
+                : arena {&arena_}
+                , marker {arena_.mark()}
+            {}
+            ~Scope()
+            {
+                this->arena->rewind(this->marker);
+            }
+
+            Scope(const Scope&)             = delete;
+            Scope(Scope&&)                  = delete;
+            Scope& operator= (const Scope&) = delete;
+            Scope& operator= (Scope&&)      = delete;
+
+            [[nodiscard]] std::pmr::memory_resource* getResource() const
+            {
+                return this->arena->getResource();
+            }
+
+        private:
+            FrameArena* arena;
+            Marker      marker;
+        };
+
+    public:
+        FrameArena(u32 framesInFlight, usize initialBytesPerFrame);
+        ~FrameArena() = default;
+
+        FrameArena(const FrameArena&)             = delete;
+        FrameArena(FrameArena&&)                  = delete;
+        FrameArena& operator= (const FrameArena&) = delete;
+        FrameArena& operator= (FrameArena&&)      = delete;
+
+        /// Switches to and resets the region of this frame, repeated calls with the same frame number do nothing
+        void beginFrame(u32 frameNumber);
+
+        [[nodiscard]] std::pmr::memory_resource* getResource();
+
+        [[nodiscard]] Marker mark() const;
+        void                 rewind(Marker);
+
+    private:
+        class Region final : public std::pmr::memory_resource
+        {
+        public:
+            explicit Region(usize capacity);
+            ~Region() override;
+
+            Region(const Region&)             = delete;
+            Region(Region&&)                  = delete;
+            Region& operator= (const Region&) = delete;
+            Region& operator= (Region&&)      = delete;
+
+            void                 reset();
+            [[nodiscard]] Marker mark() const;
+            void                 rewind(Marker);
+
+        private:
+            struct OverflowAllocation
+            {
+                void* memory;
+                usize bytes;
+                usize alignment;
+            };
+
+            void* do_allocate(usize bytes, usize alignment) override;
+            // Individual frees are ignored, everything is reclaimed at once by reset() or rewind()
+            void do_deallocate(void*, usize, usize) override {}
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+            void freeOverflowAllocations(usize numberToKeep);
+
+            std::unique_ptr<std::byte[]>    block;
+            usize                           capacity;
+            usize                           offset;
+            usize                           overflow_bytes_in_use;
+            usize                           peak_bytes_in_use;
+            std::vector<OverflowAllocation> overflow_allocations;
+        };
+
+        std::vector<std::unique_ptr<Region>> regions;
+        u32                                  current_region;
+        u32                                  last_frame_number;
+        bool                                 has_begun_frame;
+    };
+} // namespace util
@@ -18,9 +18,12 @@ namespace util
     }
 
     IndexAllocator::IndexAllocator(IndexType blocks)
-        : next_available_block {0}
+        : number_allocated {0}
+        , upper_bound {0}
         , max_number_of_blocks {blocks}
-    {}
+    {
+        this->rebuildSummaries();
+    }
 
     void IndexAllocator::updateAvailableBlockAmount(IndexType newAmount)
     {
@@ -29,40 +32,54 @@ namespace util
             "Tried to update an allocator with less bricks!");
 
         this->max_number_of_blocks = newAmount;
+
+        this->rebuildSummaries();
     }
 
     std::expected<IndexAllocator::IndexType, IndexAllocator::OutOfBlocks> IndexAllocator::allocate()
     {
-        if (this->free_block_list.empty())
+        if (this->free_bits.back().front() == 0)
         {
-            const IndexType nextFreeBlock = this->next_available_block;
+            return std::unexpected(OutOfBlocks {});
+        }
 
-            ++this->next_available_block;
+        // Walk down from the single top word, taking the lowest set bit at every level
+        usize wordIndex = 0;
 
-            if (this->next_available_block > this->max_number_of_blocks)
-            {
-                return std::unexpected(OutOfBlocks {});
-            }
+        for (usize level = this->free_bits.size() - 1; level > 0; --level)
+        {
+            wordIndex = (wordIndex * 64) + static_cast<usize>(std::countr_zero(this->free_bits[level][wordIndex]));
+        }
+
+        std::vector<u64>& leaves   = this->free_bits.front();
+        const IndexType   newBlock = static_cast<IndexType>(
+            (wordIndex * 64) + static_cast<usize>(std::countr_zero(leaves[wordIndex])));
 
-            return nextFreeBlock;
+        if (newBlock >= this->max_number_of_blocks)
+        {
+            panic(
+                "Out of bounds block #{} was free in allocator of size #{}!", newBlock, this->max_number_of_blocks);
         }
-        else
+
+        // Clear the bit and propagate upwards for as long as words become empty
+        for (usize level = 0; level < this->free_bits.size(); ++level)
         {
-            IndexType freeListBlock = *this->free_block_list.rbegin();
+            u64& word = this->free_bits[level][wordIndex];
 
-            this->free_block_list.erase(freeListBlock);
+            word &= word - 1;
 
-            if (freeListBlock >= this->max_number_of_blocks)
+            if (word != 0)
             {
-                panic(
-                    "Out of bounds block #{} was in freelist of allocator of "
-                    "size #{}! Recursing!",
-                    freeListBlock,
-                    this->max_number_of_blocks);
+                break;
             }
 
-            return freeListBlock;
+            wordIndex /= 64;
         }
+
+        this->number_allocated += 1;
+        this->upper_bound = std::max(this->upper_bound, newBlock + 1);
+
+        return newBlock;
     }
 
     void IndexAllocator::free(IndexType blockToFree)
@@ -72,17 +89,104 @@ namespace util
             throw FreeOfUntrackedValue {};
         }
 
-        const auto& [maybeIterator, valid] = this->free_block_list.insert_unique(blockToFree);
+        usize index = blockToFree;
 
-        while (this->free_block_list.contains(this->next_available_block - 1))
+        if ((this->free_bits.front()[index / 64] & (u64 {1} << (index % 64))) != 0)
         {
-            this->free_block_list.erase(this->next_available_block - 1);
-            --this->next_available_block;
+            throw DoubleFree {};
         }
 
-        if (!valid)
+        // Set the bit and propagate upwards until we reach a word that already had free bits
+        for (usize level = 0; level < this->free_bits.size(); ++level)
         {
-            throw DoubleFree {};
+            u64&      word     = this->free_bits[level][index / 64];
+            const u64 oldValue = word;
+
+            word |= u64 {1} << (index % 64);
+
+            if (oldValue != 0)
+            {
+                break;
+            }
+
+            index /= 64;
+        }
+
+        this->number_allocated -= 1;
+
+        if (blockToFree + 1 == this->upper_bound)
+        {
+            const std::vector<u64>& leaves = this->free_bits.front();
+
+            // Scan back a word at a time to the highest block that is still allocated
+            usize word = (blockToFree / 64) + 1;
+            u64   mask = blockToFree % 64 == 63 ? ~u64 {0} : (u64 {1} << ((blockToFree % 64) + 1)) - 1;
+
+            this->upper_bound = 0;
+
+            while (word > 0)
+            {
+                --word;
+
+                if (const u64 alive = ~leaves[word] & mask; alive != 0)
+                {
+                    this->upper_bound = static_cast<IndexType>((word * 64) + 64 - std::countl_zero(alive));
+
+                    break;
+                }
+
+                mask = ~u64 {0};
+            }
+        }
+    }
+
+    void IndexAllocator::rebuildSummaries()
+    {
+        const usize numberOfLeafWords = std::max<usize>(1, (this->max_number_of_blocks + 63) / 64);
+
+        // Existing leaf words are kept as is, new blocks start out free and padding bits are never free
+        std::vector<u64> leaves =
+            this->free_bits.empty() ? std::vector<u64> {} : std::move(this->free_bits.front());
+        const usize oldNumberOfLeafWords = leaves.size();
+
+        leaves.resize(numberOfLeafWords, 0);
+
+        for (usize word = oldNumberOfLeafWords == 0 ? 0 : oldNumberOfLeafWords - 1; word < numberOfLeafWords; ++word)
+        {
+            for (usize bit = 0; bit < 64; ++bit)
+            {
+                const usize index = (word * 64) + bit;
+
+                if (index >= this->upper_bound && index < this->max_number_of_blocks)
+                {
+                    leaves[word] |= u64 {1} << bit;
+                }
+            }
+        }
+
+        this->free_bits.clear();
+        this->free_bits.push_back(std::move(leaves));
+
+        while (this->free_bits.back().size() > 1)
+        {
+            const std::vector<u64>& children = this->free_bits.back();
+            std::vector<u64>        parents((children.size() + 63) / 64, 0);
+
+            for (usize i = 0; i < children.size(); ++i)
+            {
+                if (children[i] != 0)
+                {
+                    parents[i / 64] |= u64 {1} << (i % 64);
+                }
+            }
+
+            this->free_bits.push_back(std::move(parents));
+        }
+
+        // A single leaf word still needs a summary so that allocate() can tell when it is exhausted
+        if (this->free_bits.size() == 1)
+        {
+            this->free_bits.push_back({this->free_bits.front().front() != 0 ? u64 {1} : u64 {0}});
         }
     }
 
@@ -2,14 +2,20 @@
 
 #include "util/logger.hpp"
 #include "util/util.hpp"
-#include <boost/container/flat_set.hpp>
+#include <bit>
 #include <expected>
 #include <source_location>
+#include <vector>
 
 namespace util
 {
     /// Allocates unique, single integers.
     /// Useful for allocating fixed sized chunks of memory
+    ///
+    /// Free indices are tracked in a hierarchy of 64 bit words where each bit of
+    /// a parent word says whether the matching child word has any free bits.
+    /// Allocation always returns the lowest free index, keeping the allocated
+    /// range dense and getUpperBoundOnAllocatedElements() tight.
     class IndexAllocator
     {
     public:
@@ -47,7 +53,7 @@ namespace util
         void              updateAvailableBlockAmount(IndexType newAmount);
         [[nodiscard]] u32 getNumberAllocated() const
         {
-            return static_cast<u32>(this->next_available_block - this->free_block_list.size());
+            return this->number_allocated;
         }
         [[nodiscard]] f32 getPercentAllocated() const
         {
@@ -71,28 +77,47 @@ namespace util
 
         void iterateThroughAllocatedElements(std::invocable<IndexType> auto func)
         {
-            for (IndexType i = 0; i < this->next_available_block; ++i)
+            const std::vector<u64>& leaves        = this->free_bits.front();
+            const IndexType         numberOfWords = (this->upper_bound + 63) / 64;
+
+            for (IndexType word = 0; word < numberOfWords; ++word)
             {
-                if (!this->free_block_list.contains(i))
+                // padding bits past max_number_of_blocks are never free, mask them off
+                u64 alive = ~leaves[word];
+
+                if (word == numberOfWords - 1 && this->upper_bound % 64 != 0)
+                {
+                    alive &= (u64 {1} << (this->upper_bound % 64)) - 1;
+                }
+
+                while (alive != 0)
                 {
-                    func(i);
+                    func(static_cast<IndexType>((word * 64) + static_cast<IndexType>(std::countr_zero(alive))));
+
+                    alive &= alive - 1;
                 }
             }
         }
 
-        bool isElementAlive(IndexType index)
+        [[nodiscard]] bool isElementAlive(IndexType index) const
         {
-            return index < next_available_block && !this->free_block_list.contains(index);
+            return index < this->upper_bound && (this->free_bits.front()[index / 64] & (u64 {1} << (index % 64))) == 0;
         }
 
         [[nodiscard]] IndexType getUpperBoundOnAllocatedElements() const
         {
-            return this->next_available_block;
+            return this->upper_bound;
         }
 
     private:
-        boost::container::flat_set<IndexType> free_block_list;
-        IndexType                             next_available_block;
-        IndexType                             max_number_of_blocks;
+        void rebuildSummaries();
+
+        // free_bits[0] has one bit per block, set if free
+        // free_bits[n + 1] has one bit per word of free_bits[n], set if that word is non zero
+        // The last level is always a single word
+        std::vector<std::vector<u64>> free_bits;
+        IndexType                     number_allocated;
+        IndexType                     upper_bound;
+        IndexType                     max_number_of_blocks;
     };
 } // namespace util
@@ -33,6 +33,9 @@ namespace util
     template<class Handle>
     class OpaqueHandleAllocator;
 
+    template<class Handle, class T, class SlotAllocator>
+    class SlotMap;
+
     template<StringSneaker Name, class I, class FriendedClass = NoFriendDeclaration>
         requires (std::is_integral_v<I> && !std::is_floating_point_v<I>)
     struct [[nodiscard]] OpaqueHandle
@@ -103,6 +106,8 @@ namespace util
         }
 
         friend OpaqueHandleAllocator<OpaqueHandle>;
+        template<class, class, class>
+        friend class SlotMap;
         friend FriendedClass;
 
     private:
@@ -166,7 +171,7 @@ namespace util
 
         [[nodiscard]] f32 getPercentAllocated() const
         {
-            return this->getPercentAllocated();
+            return this->allocator.getPercentAllocated();
         }
 
         [[nodiscard]] Handle allocateOrPanic(std::source_location loc = std::source_location::current())
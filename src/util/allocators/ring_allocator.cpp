@@ -0,0 +1,121 @@
+#include "ring_allocator.hpp"
+#include "util/logger.hpp"
+#include <bit>
+
+namespace util
+{
+    RingAllocator::RingAllocator(u64 capacity_)
+        : capacity {capacity_}
+        , epoch {0}
+        , open_allocations {0, 0}
+        , pending_mark {std::nullopt}
+        , head {0}
+        , tail {0}
+    {}
+
+    std::optional<RingAllocator::Allocation> RingAllocator::tryAllocate(u64 size, u64 alignment)
+    {
+        assert::critical(
+            std::has_single_bit(alignment) && this->capacity % alignment == 0,
+            "RingAllocator alignment of {} is invalid",
+            alignment);
+
+        if (size > this->capacity)
+        {
+            return std::nullopt;
+        }
+
+        // Opening before touching the head means a mark can never observe the head past us while we are still
+        // uncounted. If the epoch moved while we were opening, a mark may already be waiting on the old one
+        u32 openEpoch = this->epoch.load(std::memory_order_seq_cst);
+
+        while (true)
+        {
+            this->open_allocations[openEpoch % 2].fetch_add(1, std::memory_order_seq_cst);
+
+            const u32 currentEpoch = this->epoch.load(std::memory_order_seq_cst);
+
+            if (currentEpoch == openEpoch)
+            {
+                break;
+            }
+
+            this->open_allocations[openEpoch % 2].fetch_sub(1, std::memory_order_release);
+            openEpoch = currentEpoch;
+        }
+
+        Position oldHead = this->head.load(std::memory_order_relaxed);
+        Position start   = 0;
+
+        while (true)
+        {
+            start = (oldHead + alignment - 1) & ~(alignment - 1);
+
+            // The capacity is a multiple of the alignment so skipping to the start keeps us aligned
+            if ((start % this->capacity) + size > this->capacity)
+            {
+                start += this->capacity - (start % this->capacity);
+            }
+
+            if (start + size - this->tail.load(std::memory_order_acquire) > this->capacity)
+            {
+                this->open_allocations[openEpoch % 2].fetch_sub(1, std::memory_order_release);
+
+                return std::nullopt;
+            }
+
+            if (this->head.compare_exchange_weak(oldHead, start + size, std::memory_order_seq_cst))
+            {
+                break;
+            }
+        }
+
+        return Allocation {.offset {start % this->capacity}, .size {size}, .epoch {openEpoch}};
+    }
+
+    void RingAllocator::close(const Allocation& allocation)
+    {
+        this->open_allocations[allocation.epoch % 2].fetch_sub(1, std::memory_order_release);
+    }
+
+    std::optional<RingAllocator::Position> RingAllocator::tryMark()
+    {
+        std::optional<Position> result = std::nullopt;
+
+        if (this->pending_mark.has_value())
+        {
+            // The other parity is still in use by that epoch, a new one can't start until it drains
+            if (this->open_allocations[this->pending_mark->epoch % 2].load(std::memory_order_seq_cst) != 0)
+            {
+                return std::nullopt;
+            }
+
+            result = this->pending_mark->position;
+            this->pending_mark.reset();
+        }
+
+        // Everything below this head opened before moving it and so before the epoch below ends
+        const Position markedHead  = this->head.load(std::memory_order_seq_cst);
+        const u32      markedEpoch = this->epoch.fetch_add(1, std::memory_order_seq_cst);
+
+        if (this->open_allocations[markedEpoch % 2].load(std::memory_order_seq_cst) == 0)
+        {
+            return markedHead;
+        }
+
+        this->pending_mark = PendingMark {.epoch {markedEpoch}, .position {markedHead}};
+
+        return result;
+    }
+
+    void RingAllocator::release(Position position)
+    {
+        assert::critical(
+            position >= this->tail.load(std::memory_order_relaxed)
+                && position <= this->head.load(std::memory_order_relaxed),
+            "RingAllocator::release of {} is out of order",
+            position);
+
+        this->tail.store(position, std::memory_order_release);
+    }
+} // namespace util
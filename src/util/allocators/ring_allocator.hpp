@@ -0,0 +1,79 @@
+#pragma once
+
+#include "util/util.hpp"
+#include <array>
+#include <atomic>
+#include <optional>
+
+namespace util
+{
+    /// Lock free FIFO allocator over a fixed range of bytes, for memory that is written by the cpu and then consumed
+    /// by the gpu in submission order, like a staging buffer.
+    ///
+    /// Any thread may allocate, space is handed out by bumping an atomic head that never wraps, an allocation that
+    /// would straddle the end of the range skips to the start instead. Space is only given back in bulk by moving the
+    /// tail, which a single consumer does once it knows everything before a position has been consumed.
+    ///
+    /// Allocations are open until the owner calls close(). A position returned by tryMark() is only handed out once
+    /// every allocation before it has been closed, so they can all be retired along with it. Open allocations are
+    /// counted per epoch and marking starts a new epoch, so a steady stream of new allocations never holds a mark
+    /// back, only the ones that were already open when it was taken.
+    class RingAllocator
+    {
+    public:
+        using Position = u64;
+
+        struct Allocation
+        {
+            u64 offset;
+            u64 size;
+            u32 epoch;
+        };
+
+    public:
+        explicit RingAllocator(u64 capacity);
+        ~RingAllocator() = default;
+
+        RingAllocator(const RingAllocator&)             = delete;
+        RingAllocator(RingAllocator&&)                  = delete;
+        RingAllocator& operator= (const RingAllocator&) = delete;
+        RingAllocator& operator= (RingAllocator&&)      = delete;
+
+        /// Thread safe. The returned allocation is open and must be closed
+        /// alignment must be a power of two that divides the capacity
+        [[nodiscard]] std::optional<Allocation> tryAllocate(u64 size, u64 alignment);
+        /// Thread safe. The allocation's space is reclaimed by the first release past it
+        void close(const Allocation&);
+
+        /// Returns the newest position that everything before has been closed, or std::nullopt if that hasn't
+        /// moved since the last mark. Positions must be released in the order they were marked
+        /// Only one thread may mark and release
+        [[nodiscard]] std::optional<Position> tryMark();
+        void                                  release(Position);
+
+        [[nodiscard]] u64 getCapacity() const
+        {
+            return this->capacity;
+        }
+        /// Includes the padding skipped for alignment and wrapping
+        [[nodiscard]] u64 getBytesInUse() const
+        {
+            return this->head.load(std::memory_order_relaxed) - this->tail.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct PendingMark
+        {
+            u32      epoch;
+            Position position;
+        };
+
+        u64                             capacity;
+        std::atomic<u32>                epoch;
+        // Indexed by the parity of the epoch, only the current and previous epoch can have open allocations
+        std::array<std::atomic<u64>, 2> open_allocations;
+        std::optional<PendingMark>      pending_mark;
+        std::atomic<Position>           head;
+        std::atomic<Position>           tail;
+    };
+} // namespace util
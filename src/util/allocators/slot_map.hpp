@@ -0,0 +1,222 @@
+#pragma once
+
+#include "index_allocator.hpp"
+#include "opaque_integer_handle_allocator.hpp"
+#include "util/logger.hpp"
+#include "util/util.hpp"
+#include <expected>
+#include <source_location>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace util
+{
+    /// Generational slot map
+    /// Values are stored densely and destroyed by swap removal, so walking them only ever touches live elements.
+    /// Each element also owns a stable slot for as long as it lives, which is what external tables (e.g. gpu
+    /// buffers) should be indexed by. Handles carry their slot's generation, so stale handles are caught in O(1).
+    /// reserve() is thread safe when SlotAllocator is (see ConcurrentIndexAllocator), everything else must happen
+    /// on the thread that owns the map.
+    template<class Handle, class T, class SlotAllocator = IndexAllocator>
+    class SlotMap
+    {
+    public:
+        using IndexType = Handle::IndexType;
+
+        // the low half of a handle is the slot, the high half is the generation
+        static constexpr u32       SlotBits = sizeof(IndexType) * 4;
+        static constexpr IndexType SlotMask = (IndexType {1} << SlotBits) - 1;
+        static_assert(sizeof(IndexType) >= sizeof(u32), "Handles need room for both a slot and a generation");
+
+    public:
+        // The all ones slot is never handed out, so a live handle can never equal Handle::NullValue
+        explicit SlotMap(u32 capacity)
+            : slot_allocator {capacity}
+            , generations(capacity, 0)
+            , dense_index_of_slot(capacity, ~0u)
+        {
+            assert::critical(capacity < SlotMask, "SlotMap of capacity {} is too large for its handle", capacity);
+
+            this->slot_of_dense_index.reserve(capacity);
+            this->values.reserve(capacity);
+        }
+        ~SlotMap() = default;
+
+        SlotMap(const SlotMap&)             = delete;
+        SlotMap(SlotMap&&)                  = default;
+        SlotMap& operator= (const SlotMap&) = delete;
+        SlotMap& operator= (SlotMap&&)      = default;
+
+        [[nodiscard]] Handle insertOrPanic(T value, std::source_location loc = std::source_location::current())
+        {
+            std::expected<Handle, IndexAllocator::OutOfBlocks> maybeHandle = this->insert(std::move(value));
+
+            if (!maybeHandle.has_value())
+            {
+                panic<>("util::SlotMap::insertOrPanic failed!", loc);
+            }
+
+            return std::move(*maybeHandle);
+        }
+
+        [[nodiscard]] std::expected<Handle, IndexAllocator::OutOfBlocks> insert(T value)
+        {
+            return this->reserve().transform(
+                [&](Handle handle)
+                {
+                    this->commit(handle, std::move(value));
+
+                    return handle;
+                });
+        }
+
+        /// Claims a slot without creating the element, the handle is not alive until it is passed to commit()
+        [[nodiscard]] std::expected<Handle, IndexAllocator::OutOfBlocks> reserve()
+        {
+            return this->slot_allocator.allocate().transform(
+                [&](const IndexAllocator::IndexType slot)
+                {
+                    return Handle {static_cast<IndexType>((this->generations[slot] << SlotBits) | slot)};
+                });
+        }
+
+        void commit(const Handle& reserved, T value)
+        {
+            const u32 slot = this->getSlotOfReservation(reserved);
+
+            this->dense_index_of_slot[slot] = static_cast<u32>(this->values.size());
+            this->slot_of_dense_index.push_back(slot);
+            this->values.push_back(std::move(value));
+        }
+
+        void cancelReservation(Handle reserved)
+        {
+            const u32 slot = this->getSlotOfReservation(reserved);
+            std::ignore    = reserved.release();
+
+            this->generations[slot] = (this->generations[slot] + 1) & SlotMask;
+            this->slot_allocator.free(slot);
+        }
+
+        /// Moves the last element into the hole, so the dense index of at most one other element changes
+        T erase(Handle handle)
+        {
+            const u32 slot = this->getSlotOfHandle(handle);
+            std::ignore    = handle.release();
+
+            const u32 denseIndex = this->dense_index_of_slot[slot];
+            T         erased     = std::move(this->values[denseIndex]);
+
+            if (denseIndex != this->values.size() - 1)
+            {
+                this->values[denseIndex]              = std::move(this->values.back());
+                this->slot_of_dense_index[denseIndex] = this->slot_of_dense_index.back();
+
+                this->dense_index_of_slot[this->slot_of_dense_index[denseIndex]] = denseIndex;
+            }
+
+            this->values.pop_back();
+            this->slot_of_dense_index.pop_back();
+
+            this->dense_index_of_slot[slot] = ~0u;
+            this->generations[slot]         = (this->generations[slot] + 1) & SlotMask;
+            this->slot_allocator.free(slot);
+
+            return erased;
+        }
+
+        [[nodiscard]] bool isHandleAlive(const Handle& handle) const
+        {
+            const IndexType value = handle.getValue();
+            const IndexType slot  = value & SlotMask;
+
+            return !handle.isNull() && slot < this->generations.size() && this->dense_index_of_slot[slot] != ~0u
+                && this->generations[slot] == (value >> SlotBits);
+        }
+
+        /// Panics if the handle has outlived its element
+        [[nodiscard]] u32 getSlotOfHandle(const Handle& handle) const
+        {
+            assert::critical(
+                this->isHandleAlive(handle),
+                "Stale or null {} {}",
+                Handle::HandleName.getStringView(),
+                handle.getValue());
+
+            return static_cast<u32>(handle.getValue() & SlotMask);
+        }
+
+        [[nodiscard]] T& get(const Handle& handle)
+        {
+            return this->values[this->dense_index_of_slot[this->getSlotOfHandle(handle)]];
+        }
+        [[nodiscard]] const T& get(const Handle& handle) const
+        {
+            return this->values[this->dense_index_of_slot[this->getSlotOfHandle(handle)]];
+        }
+
+        [[nodiscard]] T& getBySlot(u32 slot)
+        {
+            return this->values[this->getDenseIndexOfSlot(slot)];
+        }
+        [[nodiscard]] const T& getBySlot(u32 slot) const
+        {
+            return this->values[this->getDenseIndexOfSlot(slot)];
+        }
+
+        [[nodiscard]] u32 getDenseIndexOfSlot(u32 slot) const
+        {
+            assert::critical(
+                slot < this->dense_index_of_slot.size() && this->dense_index_of_slot[slot] != ~0u,
+                "Slot {} is not alive",
+                slot);
+
+            return this->dense_index_of_slot[slot];
+        }
+
+        [[nodiscard]] u32 size() const
+        {
+            return static_cast<u32>(this->values.size());
+        }
+
+        /// Live values, in the same order as getDenseSlots()
+        [[nodiscard]] std::span<T> getDenseValues()
+        {
+            return this->values;
+        }
+        [[nodiscard]] std::span<const T> getDenseValues() const
+        {
+            return this->values;
+        }
+
+        [[nodiscard]] std::span<const u32> getDenseSlots() const
+        {
+            return this->slot_of_dense_index;
+        }
+
+    private:
+        [[nodiscard]] u32 getSlotOfReservation(const Handle& reserved) const
+        {
+            const IndexType value = reserved.getValue();
+            const IndexType slot  = value & SlotMask;
+
+            assert::critical(
+                !reserved.isNull() && slot < this->generations.size() && this->dense_index_of_slot[slot] == ~0u
+                    && this->generations[slot] == (value >> SlotBits),
+                "{} {} is not an outstanding reservation",
+                Handle::HandleName.getStringView(),
+                value);
+
+            return static_cast<u32>(slot);
+        }
+
+        SlotAllocator          slot_allocator;
+        std::vector<IndexType> generations;
+        std::vector<u32>       dense_index_of_slot;
+        std::vector<u32>       slot_of_dense_index;
+        std::vector<T>         values;
+    };
+} // namespace util
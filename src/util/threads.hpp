@@ -1,9 +1,15 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <bit>
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <future>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -297,6 +303,204 @@ namespace util
         mutable std::tuple<T...>                   tuple;
     }; // class Mutex
 
+    /// Lock free multiple producer single consumer queue
+    /// Producers push onto an intrusive stack with a single CAS, the consumer takes the whole stack at once and
+    /// reverses it, so drain() returns the elements in the order their pushes landed.
+    /// Nodes are pooled and never freed before the queue is. Drained nodes go onto a free list that push() takes
+    /// from, so once the pool has grown to the most elements ever queued at once, pushing doesn't allocate.
+    template<class T>
+        requires std::default_initializable<T> && std::movable<T>
+    class MpscQueue
+    {
+    public:
+
+        MpscQueue()
+            : head {NullIndex}
+            , free_head {NullIndex}
+            , blocks {}
+            , number_of_blocks {0}
+        {}
+        ~MpscQueue()
+        {
+            for (std::atomic<Node*>& block : this->blocks)
+            {
+                delete[] block.load(std::memory_order_acquire);
+            }
+        }
+
+        MpscQueue(const MpscQueue&)             = delete;
+        MpscQueue(MpscQueue&&)                  = delete;
+        MpscQueue& operator= (const MpscQueue&) = delete;
+        MpscQueue& operator= (MpscQueue&&)      = delete;
+
+        /// Any thread
+        void push(T t) const
+        {
+            const std::uint32_t index = this->allocateNode();
+            Node&               node  = this->getNode(index);
+
+            node.value = std::move(t);
+
+            std::uint32_t next = this->head.load(std::memory_order_relaxed);
+            node.next.store(next, std::memory_order_relaxed);
+
+            while (!this->head.compare_exchange_weak(
+                next, index, std::memory_order_release, std::memory_order_relaxed))
+            {
+                node.next.store(next, std::memory_order_relaxed);
+            }
+        }
+
+        /// Only one thread at a time. Appends to output so the caller can reuse its capacity
+        void drain(std::vector<T>& output) const
+        {
+            std::uint32_t index = this->head.exchange(NullIndex, std::memory_order_acquire);
+            std::uint32_t first = NullIndex;
+
+            std::size_t numberOfNodes = 0;
+
+            while (index != NullIndex)
+            {
+                Node&               node = this->getNode(index);
+                const std::uint32_t next = node.next.load(std::memory_order_relaxed);
+
+                node.next.store(first, std::memory_order_relaxed);
+                first = index;
+                index = next;
+
+                numberOfNodes += 1;
+            }
+
+            if (first == NullIndex)
+            {
+                return;
+            }
+
+            output.reserve(output.size() + numberOfNodes);
+
+            std::uint32_t last = first;
+
+            for (std::uint32_t i = first; i != NullIndex; i = this->getNode(i).next.load(std::memory_order_relaxed))
+            {
+                output.push_back(std::move(this->getNode(i).value));
+                last = i;
+            }
+
+            this->freeNodes(first, last);
+        }
+
+    private:
+        static constexpr std::uint32_t NullIndex = std::numeric_limits<std::uint32_t>::max();
+        // Block n holds FirstBlockSize << n nodes, so indices never move and the pool doubles as it grows
+        static constexpr std::uint32_t FirstBlockSize = 64;
+        static constexpr std::uint32_t MaxBlocks      = 24;
+
+        struct Node
+        {
+            T value;
+            // Atomic because a producer that lost a race in allocateNode() may still read it after the node has
+            // been handed out again
+            std::atomic<std::uint32_t> next;
+        };
+
+        [[nodiscard]] static std::uint32_t getFirstIndexOfBlock(std::uint32_t block)
+        {
+            return FirstBlockSize * ((1u << block) - 1);
+        }
+
+        [[nodiscard]] Node& getNode(std::uint32_t index) const
+        {
+            const auto block = static_cast<std::uint32_t>(std::bit_width((index / FirstBlockSize) + 1) - 1);
+
+            return this->blocks[block].load(std::memory_order_acquire)[index - getFirstIndexOfBlock(block)];
+        }
+
+        // The free list head packs a tag above the index. The tag changes on every update, so a producer that
+        // read a stale next can't ABA its way into corrupting the list
+        [[nodiscard]] static std::uint64_t makeFreeHead(std::uint64_t oldFreeHead, std::uint32_t index)
+        {
+            return (((oldFreeHead >> 32) + 1) << 32) | index;
+        }
+
+        [[nodiscard]] std::uint32_t allocateNode() const
+        {
+            while (true)
+            {
+                std::uint64_t oldFreeHead = this->free_head.load(std::memory_order_acquire);
+
+                while (static_cast<std::uint32_t>(oldFreeHead) != NullIndex)
+                {
+                    const std::uint32_t index = static_cast<std::uint32_t>(oldFreeHead);
+                    const std::uint32_t next  = this->getNode(index).next.load(std::memory_order_relaxed);
+
+                    if (this->free_head.compare_exchange_weak(
+                            oldFreeHead,
+                            makeFreeHead(oldFreeHead, next),
+                            std::memory_order_acquire,
+                            std::memory_order_acquire))
+                    {
+                        return index;
+                    }
+                }
+
+                this->grow();
+            }
+        }
+
+        // first to last must already be linked through next
+        void freeNodes(std::uint32_t first, std::uint32_t last) const
+        {
+            Node&         lastNode    = this->getNode(last);
+            std::uint64_t oldFreeHead = this->free_head.load(std::memory_order_relaxed);
+
+            lastNode.next.store(static_cast<std::uint32_t>(oldFreeHead), std::memory_order_relaxed);
+
+            while (!this->free_head.compare_exchange_weak(
+                oldFreeHead, makeFreeHead(oldFreeHead, first), std::memory_order_release, std::memory_order_relaxed))
+            {
+                lastNode.next.store(static_cast<std::uint32_t>(oldFreeHead), std::memory_order_relaxed);
+            }
+        }
+
+        void grow() const
+        {
+            std::unique_lock lock {this->grow_mutex};
+
+            // Someone else grew, or the consumer gave nodes back, while we were waiting
+            if (static_cast<std::uint32_t>(this->free_head.load(std::memory_order_acquire)) != NullIndex)
+            {
+                return;
+            }
+
+            const std::uint32_t block = this->number_of_blocks;
+
+            if (block == MaxBlocks)
+            {
+                std::abort();
+            }
+
+            const std::uint32_t blockSize  = FirstBlockSize << block;
+            const std::uint32_t firstIndex = getFirstIndexOfBlock(block);
+            Node* const         nodes      = new Node[blockSize];
+
+            for (std::uint32_t i = 0; i < blockSize - 1; ++i)
+            {
+                nodes[i].next.store(firstIndex + i + 1, std::memory_order_relaxed);
+            }
+
+            this->blocks[block].store(nodes, std::memory_order_release);
+            this->number_of_blocks += 1;
+
+            this->freeNodes(firstIndex, firstIndex + blockSize - 1);
+        }
+
+        mutable std::atomic<std::uint32_t>                head;
+        mutable std::atomic<std::uint64_t>                free_head;
+        mutable std::array<std::atomic<Node*>, MaxBlocks> blocks;
+        mutable std::mutex                                grow_mutex;
+        mutable std::uint32_t                             number_of_blocks;
+    }; // class MpscQueue
+
     inline std::byte* threadedMemcpy(std::byte* dst, std::span<const std::byte> src)
     {
         const std::size_t numberOfThreads      = std::thread::hardware_concurrency() * 3 / 4;
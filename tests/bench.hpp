@@ -0,0 +1,42 @@
+#pragma once
+
+#include "util/util.hpp"
+#include <chrono>
+#include <fmt/format.h>
+#include <string_view>
+
+namespace bench
+{
+    /// Keeps the compiler from discarding a result that is otherwise unused
+    template<class T>
+    void doNotOptimize(const T& value)
+    {
+#if defined(_MSC_VER)
+        const volatile T* volatile sink = &value;
+        static_cast<void>(sink);
+#else
+        asm volatile("" : : "r,m"(value) : "memory");
+#endif
+    }
+
+    /// Runs func iterations times and prints the average time taken by one call
+    template<class Fn>
+    f64 measure(std::string_view name, u64 iterations, Fn&& func)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (u64 i = 0; i < iterations; ++i)
+        {
+            func();
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+
+        const f64 nanoseconds =
+            std::chrono::duration<f64, std::nano> {end - start}.count() / static_cast<f64>(iterations);
+
+        fmt::println("{:<48} {:>12.2f} ns", name, nanoseconds);
+
+        return nanoseconds;
+    }
+} // namespace bench
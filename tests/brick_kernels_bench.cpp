@@ -0,0 +1,131 @@
+#include "bench.hpp"
+#include "gfx/generators/voxel/brick_kernels.hpp"
+#include "gfx/generators/voxel/data_structures.hpp"
+#include <bit>
+#include <cstring>
+#include <fmt/format.h>
+#include <random>
+#include <vector>
+
+using namespace gfx::generators::voxel; // NOLINT
+
+namespace
+{
+    constexpr u64 Iterations = 4096;
+    constexpr u64 BrickCount = 256;
+
+    // Mostly compact bricks, with every fourth one getting a single differing voxel late in the brick so the
+    // early outs don't hide the cost of the full scan
+    std::vector<CombinedBrick> makeBricks()
+    {
+        std::minstd_rand0                  gen {7};
+        std::uniform_int_distribution<u16> materialDist {0, 4};
+        std::vector<CombinedBrick>         bricks(BrickCount);
+
+        for (u64 i = 0; i < BrickCount; ++i)
+        {
+            bricks[i].fill(materialDist(gen));
+
+            if (i % 4 == 0)
+            {
+                bricks[i].write(BrickLocalPosition {7, 7, 7}, 5);
+            }
+        }
+
+        return bricks;
+    }
+
+    void compare(std::string_view name, auto scalar, auto vectorised)
+    {
+        const f64 scalarTime     = bench::measure(fmt::format("{} scalar", name), Iterations, scalar);
+        const f64 vectorisedTime =
+            bench::measure(fmt::format("{} {}", name, getBrickKernelInstructionSet()), Iterations, vectorised);
+
+        fmt::println("{:<48} {:>12.2f}x", "speedup", scalarTime / vectorisedTime);
+    }
+} // namespace
+
+int main()
+{
+    std::vector<CombinedBrick> bricks = makeBricks();
+    std::vector<CombinedBrick> copies = bricks;
+
+    compare(
+        "fill x256",
+        [&]
+        {
+            for (CombinedBrick& b : bricks)
+            {
+                b.fill(3);
+            }
+            bench::doNotOptimize(bricks);
+        },
+        [&]
+        {
+            for (CombinedBrick& b : bricks)
+            {
+                fillCombinedBrick(b, 3);
+            }
+            bench::doNotOptimize(bricks);
+        });
+
+    bricks = makeBricks();
+
+    compare(
+        "isCompact x256",
+        [&]
+        {
+            for (const CombinedBrick& b : bricks)
+            {
+                bench::doNotOptimize(b.isCompact());
+            }
+        },
+        [&]
+        {
+            for (const CombinedBrick& b : bricks)
+            {
+                bench::doNotOptimize(isCombinedBrickCompact(b));
+            }
+        });
+
+    compare(
+        "countSolidVoxels x256",
+        [&]
+        {
+            for (const CombinedBrick& b : bricks)
+            {
+                u32 count = 0;
+
+                for (u32 w : b.boolean_brick.data)
+                {
+                    count += static_cast<u32>(std::popcount(w));
+                }
+
+                bench::doNotOptimize(count);
+            }
+        },
+        [&]
+        {
+            for (const CombinedBrick& b : bricks)
+            {
+                bench::doNotOptimize(countSolidVoxels(b.boolean_brick));
+            }
+        });
+
+    compare(
+        "equality x256",
+        [&]
+        {
+            for (u64 i = 0; i < BrickCount; ++i)
+            {
+                bench::doNotOptimize(std::memcmp(&bricks[i], &copies[i], sizeof(CombinedBrick)) == 0);
+            }
+        },
+        [&]
+        {
+            for (u64 i = 0; i < BrickCount; ++i)
+            {
+                bench::doNotOptimize(areCombinedBricksEqual(bricks[i], copies[i]));
+            }
+        });
+}
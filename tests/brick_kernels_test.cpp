@@ -0,0 +1,77 @@
+#include "gfx/generators/voxel/brick_kernels.hpp"
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "util/logger.hpp"
+#include <bit>
+#include <random>
+
+using namespace gfx::generators::voxel; // NOLINT
+
+namespace
+{
+    // The vectorised kernels must agree with the reference implementations in shared_data_structures.slang
+    void testBrickKernels()
+    {
+        std::minstd_rand0                  gen {7};
+        std::uniform_int_distribution<u16> materialDist {0, 4};
+        std::uniform_int_distribution<u16> positionDist {0, 7};
+
+        for (int i = 0; i < 256; ++i)
+        {
+            const u16 fillMaterial = materialDist(gen);
+
+            CombinedBrick reference {};
+            CombinedBrick vectorised {};
+            reference.fill(fillMaterial);
+            fillCombinedBrick(vectorised, fillMaterial);
+
+            assert::critical(
+                areCombinedBricksEqual(reference, vectorised), "fillCombinedBrick({}) disagrees", fillMaterial);
+
+            // Half of the bricks get a single differing voxel
+            if (i % 2 == 1)
+            {
+                const BrickLocalPosition bP {positionDist(gen), positionDist(gen), positionDist(gen)};
+                const u16                newMaterial = materialDist(gen);
+
+                reference.write(bP, newMaterial);
+
+                assert::critical(
+                    areCombinedBricksEqual(reference, vectorised) == (newMaterial == fillMaterial),
+                    "areCombinedBricksEqual disagrees");
+
+                vectorised = reference;
+            }
+
+            const CombinedBrickReadResult referenceResult  = reference.isCompact();
+            const CombinedBrickReadResult vectorisedResult = isCombinedBrickCompact(vectorised);
+
+            assert::critical(
+                referenceResult.solid == vectorisedResult.solid && referenceResult.voxel == vectorisedResult.voxel,
+                "isCombinedBrickCompact disagrees, expected {{{}, {}}} got {{{}, {}}}",
+                referenceResult.solid,
+                referenceResult.voxel,
+                vectorisedResult.solid,
+                vectorisedResult.voxel);
+
+            u32 referenceSolidVoxels = 0;
+
+            for (u32 w : reference.boolean_brick.data)
+            {
+                referenceSolidVoxels += static_cast<u32>(std::popcount(w));
+            }
+
+            assert::critical(
+                countSolidVoxels(vectorised.boolean_brick) == referenceSolidVoxels,
+                "countSolidVoxels disagrees, expected {} got {}",
+                referenceSolidVoxels,
+                countSolidVoxels(vectorised.boolean_brick));
+        }
+    }
+} // namespace
+
+int main()
+{
+    testBrickKernels();
+
+    log::info("brick kernels ({}) agree with the reference", getBrickKernelInstructionSet());
+}
@@ -0,0 +1,97 @@
+#include "util/allocators/concurrent_index_allocator.hpp"
+#include "util/allocators/index_allocator.hpp"
+#include "util/threads.hpp"
+#include <array>
+#include <chrono>
+#include <fmt/format.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr u32 Capacity            = 1u << 20;
+    constexpr u32 OperationsPerThread = 1u << 18;
+    // Each thread holds a few indices at a time, like workers reserving chunks
+    constexpr u32 HeldPerThread       = 16;
+
+    /// Returns millions of allocate + free pairs per second, summed over every thread
+    template<class Allocate, class Free>
+    f64 runContended(u32 numberOfThreads, Allocate allocate, Free free)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        {
+            std::vector<std::jthread> threads {};
+
+            for (u32 t = 0; t < numberOfThreads; ++t)
+            {
+                threads.emplace_back(
+                    [&]
+                    {
+                        std::array<u32, HeldPerThread> held {};
+
+                        for (u32 i = 0; i < OperationsPerThread / HeldPerThread; ++i)
+                        {
+                            for (u32& h : held)
+                            {
+                                h = allocate();
+                            }
+
+                            for (u32 h : held)
+                            {
+                                free(h);
+                            }
+                        }
+                    });
+            }
+        }
+
+        const f64 seconds = std::chrono::duration<f64> {std::chrono::steady_clock::now() - start}.count();
+
+        return static_cast<f64>(numberOfThreads) * OperationsPerThread / seconds / 1e6;
+    }
+} // namespace
+
+int main()
+{
+    fmt::println("{} hardware threads", std::thread::hardware_concurrency());
+    fmt::println("{:>8} {:>24} {:>24}", "threads", "lock free M ops/s", "mutex M ops/s");
+
+    for (u32 numberOfThreads : {1u, 2u, 4u, 8u, 16u, 32u, 64u})
+    {
+        util::ConcurrentIndexAllocator    lockFree {Capacity};
+        util::Mutex<util::IndexAllocator> locked {util::IndexAllocator {Capacity}};
+
+        const f64 lockFreeRate = runContended(
+            numberOfThreads,
+            [&]
+            {
+                return lockFree.allocateOrPanic();
+            },
+            [&](u32 index)
+            {
+                lockFree.free(index);
+            });
+
+        const f64 lockedRate = runContended(
+            numberOfThreads,
+            [&]
+            {
+                return locked.lock(
+                    [](util::IndexAllocator& a)
+                    {
+                        return a.allocateOrPanic();
+                    });
+            },
+            [&](u32 index)
+            {
+                locked.lock(
+                    [&](util::IndexAllocator& a)
+                    {
+                        a.free(index);
+                    });
+            });
+
+        fmt::println("{:>8} {:>24.2f} {:>24.2f}", numberOfThreads, lockFreeRate, lockedRate);
+    }
+}
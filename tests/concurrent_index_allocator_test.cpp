@@ -0,0 +1,275 @@
+#include "util/allocators/concurrent_index_allocator.hpp"
+#include "util/allocators/opaque_integer_handle_allocator.hpp"
+#include "util/allocators/slot_map.hpp"
+#include "util/logger.hpp"
+#include "util/threads.hpp"
+#include <algorithm>
+#include <atomic>
+#include <expected>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using util::ConcurrentIndexAllocator;
+
+    constexpr u32 NumberOfThreads = 16;
+    constexpr u32 NoOwner         = ~0u;
+
+    // Every index is claimed in an owner table as it is handed out, two threads holding the same index at once
+    // shows up as a failed claim
+    void testNoDoubleAllocation(u32 capacity)
+    {
+        ConcurrentIndexAllocator      allocator {capacity};
+        std::vector<std::atomic<u32>> owners(capacity);
+        std::atomic<u32>              collisions {0};
+
+        for (std::atomic<u32>& o : owners)
+        {
+            o.store(NoOwner, std::memory_order_relaxed);
+        }
+
+        {
+            std::vector<std::jthread> threads {};
+
+            for (u32 t = 0; t < NumberOfThreads; ++t)
+            {
+                threads.emplace_back(
+                    [&, t]
+                    {
+                        std::vector<u32> held {};
+                        u32              seed = (t * 7919) + 1;
+
+                        for (u32 i = 0; i < 200000; ++i)
+                        {
+                            seed = (seed * 1664525) + 1013904223;
+
+                            if ((seed >> 16) % 2 == 0 && held.size() <= capacity / 8)
+                            {
+                                const std::expected<u32, ConcurrentIndexAllocator::OutOfBlocks> index =
+                                    allocator.allocate();
+
+                                if (!index.has_value())
+                                {
+                                    continue;
+                                }
+
+                                u32 expected = NoOwner;
+
+                                if (!owners[*index].compare_exchange_strong(expected, t))
+                                {
+                                    collisions.fetch_add(1);
+                                }
+
+                                held.push_back(*index);
+                            }
+                            else if (!held.empty())
+                            {
+                                const u32 index    = held.back();
+                                u32       expected = t;
+
+                                held.pop_back();
+
+                                if (!owners[index].compare_exchange_strong(expected, NoOwner))
+                                {
+                                    collisions.fetch_add(1);
+                                }
+
+                                allocator.free(index);
+                            }
+                        }
+
+                        for (u32 index : held)
+                        {
+                            owners[index].store(NoOwner);
+                            allocator.free(index);
+                        }
+                    });
+            }
+        }
+
+        assert::critical(collisions.load() == 0, "{} indices were held by two threads at once", collisions.load());
+        assert::critical(
+            allocator.getNumberAllocated() == 0, "{} indices leaked", allocator.getNumberAllocated());
+    }
+
+    // Threads race to drain the allocator and then free from different threads than allocated, after which
+    // every single index must be handed out again
+    void testEveryIndexIsReused(u32 capacity)
+    {
+        ConcurrentIndexAllocator      allocator {capacity};
+        util::Mutex<std::vector<u32>> drained {};
+
+        const auto drain = [&]
+        {
+            std::vector<std::jthread> threads {};
+
+            for (u32 t = 0; t < NumberOfThreads; ++t)
+            {
+                threads.emplace_back(
+                    [&]
+                    {
+                        std::vector<u32> mine {};
+
+                        while (const std::expected<u32, ConcurrentIndexAllocator::OutOfBlocks> index =
+                                   allocator.allocate())
+                        {
+                            mine.push_back(*index);
+                        }
+
+                        drained.lock(
+                            [&](std::vector<u32>& d)
+                            {
+                                d.insert(d.end(), mine.begin(), mine.end());
+                            });
+                    });
+            }
+        };
+
+        const auto checkDrainedExactlyOnce = [&]
+        {
+            std::vector<u32> indices = drained.moveInner();
+            std::vector<u32> counts(capacity, 0);
+
+            assert::critical(
+                indices.size() == capacity, "drained {} indices out of {}", indices.size(), capacity);
+
+            for (u32 index : indices)
+            {
+                assert::critical(index < capacity, "index {} is out of range", index);
+
+                counts[index] += 1;
+            }
+
+            for (u32 index = 0; index < capacity; ++index)
+            {
+                assert::critical(counts[index] == 1, "index {} was handed out {} times", index, counts[index]);
+            }
+
+            return indices;
+        };
+
+        drain();
+        std::vector<u32> indices = checkDrainedExactlyOnce();
+
+        {
+            std::vector<std::jthread> threads {};
+
+            for (u32 t = 0; t < NumberOfThreads; ++t)
+            {
+                threads.emplace_back(
+                    [&, t]
+                    {
+                        for (usize i = t; i < indices.size(); i += NumberOfThreads)
+                        {
+                            allocator.free(indices[i]);
+                        }
+                    });
+            }
+        }
+
+        assert::critical(allocator.getNumberAllocated() == 0, "not every index was freed");
+
+        drain();
+        std::ignore = checkDrainedExactlyOnce();
+
+        bool threw = false;
+
+        try
+        {
+            allocator.free(0);
+            allocator.free(0);
+        }
+        catch (const ConcurrentIndexAllocator::DoubleFree&)
+        {
+            threw = true;
+        }
+
+        assert::critical(threw, "double free wasn't detected");
+    }
+
+    using TestHandle = util::OpaqueHandle<"TestHandle", u64>;
+
+    // Worker threads reserve slots while the owning thread commits them, as VoxelRenderer does with chunks
+    void testSlotMapConcurrentReserve()
+    {
+        constexpr u32 Capacity = 4096;
+
+        util::SlotMap<TestHandle, u32, ConcurrentIndexAllocator> slotMap {Capacity};
+
+        for (u32 round = 0; round < 8; ++round)
+        {
+            util::Mutex<std::vector<TestHandle>> reserved {};
+
+            {
+                std::vector<std::jthread> threads {};
+
+                for (u32 t = 0; t < NumberOfThreads; ++t)
+                {
+                    threads.emplace_back(
+                        [&]
+                        {
+                            std::vector<TestHandle> mine {};
+
+                            for (u32 i = 0; i < Capacity / NumberOfThreads; ++i)
+                            {
+                                mine.push_back(*slotMap.reserve());
+                            }
+
+                            reserved.lock(
+                                [&](std::vector<TestHandle>& r)
+                                {
+                                    std::ranges::move(mine, std::back_inserter(r));
+                                });
+                        });
+                }
+            }
+
+            std::vector<TestHandle> handles = reserved.moveInner();
+            std::vector<bool>       slotSeen(Capacity, false);
+
+            assert::critical(!slotMap.reserve().has_value(), "a full slot map reserved another slot");
+
+            // Half are committed, the other half cancelled so their generations move on
+            for (usize i = 0; i < handles.size(); ++i)
+            {
+                if (i % 2 == 0)
+                {
+                    slotMap.cancelReservation(std::move(handles[i]));
+
+                    continue;
+                }
+
+                slotMap.commit(handles[i], static_cast<u32>(i));
+
+                const u32 slot = slotMap.getSlotOfHandle(handles[i]);
+
+                assert::critical(!slotSeen[slot], "slot {} was reserved twice", slot);
+                assert::critical(slotMap.get(handles[i]) == i, "slot {} holds the wrong value", slot);
+
+                slotSeen[slot] = true;
+            }
+
+            assert::critical(slotMap.size() == Capacity / 2, "slot map has {} elements", slotMap.size());
+
+            for (usize i = 1; i < handles.size(); i += 2)
+            {
+                slotMap.erase(std::move(handles[i]));
+            }
+
+            assert::critical(slotMap.size() == 0, "slot map wasn't emptied");
+        }
+    }
+} // namespace
+
+int main()
+{
+    for (u32 capacity : {64u, 1000u, 16384u})
+    {
+        testNoDoubleAllocation(capacity);
+        testEveryIndexIsReused(capacity);
+    }
+
+    testSlotMapConcurrentReserve();
+}
@@ -0,0 +1,85 @@
+#include "bench.hpp"
+#include "util/allocators/index_allocator.hpp"
+#include <algorithm>
+#include <fmt/format.h>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace
+{
+    void benchmarkIndexAllocator(u32 blocks)
+    {
+        fmt::println("IndexAllocator of {} blocks", blocks);
+
+        util::IndexAllocator allocator {blocks};
+        std::vector<u32>     allocated(blocks);
+
+        bench::measure(
+            "allocate until full, then free everything",
+            4,
+            [&]
+            {
+                for (u32& index : allocated)
+                {
+                    index = allocator.allocateOrPanic();
+                }
+
+                // Highest first so every free walks the upper bound back
+                for (auto it = allocated.rbegin(); it != allocated.rend(); ++it)
+                {
+                    allocator.free(*it);
+                }
+            });
+
+        // Half full with random holes, then free a random index and allocate the lowest one
+        std::minstd_rand0 gen {7};
+
+        for (u32 i = 0; i < blocks / 2; ++i)
+        {
+            allocated[i] = allocator.allocateOrPanic();
+        }
+
+        std::ranges::shuffle(std::span {allocated}.first(blocks / 2), gen);
+
+        for (u32 i = blocks / 4; i < blocks / 2; ++i)
+        {
+            allocator.free(allocated[i]);
+        }
+
+        std::uniform_int_distribution<u32> victimDist {0, (blocks / 4) - 1};
+
+        bench::measure(
+            "free random + allocate lowest",
+            1000000,
+            [&]
+            {
+                const u32 victim = victimDist(gen);
+
+                allocator.free(allocated[victim]);
+                allocated[victim] = allocator.allocateOrPanic();
+            });
+
+        u64 sum = 0;
+
+        bench::measure(
+            "iterateThroughAllocatedElements",
+            16,
+            [&]
+            {
+                allocator.iterateThroughAllocatedElements(
+                    [&](u32 index)
+                    {
+                        sum += index;
+                    });
+            });
+
+        bench::doNotOptimize(sum);
+    }
+} // namespace
+
+int main()
+{
+    benchmarkIndexAllocator(16 * 1024);
+    benchmarkIndexAllocator(1024 * 1024);
+}
@@ -0,0 +1,189 @@
+#include "util/allocators/index_allocator.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace
+{
+    using util::IndexAllocator;
+
+    void testLowestIndexOrder()
+    {
+        IndexAllocator allocator {200};
+
+        for (u32 i = 0; i < 200; ++i)
+        {
+            const u32 index = allocator.allocateOrPanic();
+
+            assert::critical(index == i, "allocation #{} returned {}", i, index);
+            assert::critical(allocator.getUpperBoundOnAllocatedElements() == i + 1, "upper bound wasn't dense");
+        }
+
+        assert::critical(!allocator.allocate().has_value(), "a full allocator handed out another index");
+    }
+
+    void testFreeThenReallocate()
+    {
+        IndexAllocator allocator {4096};
+
+        for (u32 i = 0; i < 4096; ++i)
+        {
+            std::ignore = allocator.allocateOrPanic();
+        }
+
+        // Spread over several leaf words and summary words, freed out of order
+        const std::vector<u32> freed {3000, 7, 64, 63, 4095, 128, 0, 1025};
+
+        for (u32 index : freed)
+        {
+            allocator.free(index);
+
+            assert::critical(!allocator.isElementAlive(index), "{} is still alive after being freed", index);
+        }
+
+        std::vector<u32> expected = freed;
+        std::ranges::sort(expected);
+
+        for (u32 e : expected)
+        {
+            const u32 index = allocator.allocateOrPanic();
+
+            assert::critical(index == e, "expected to reuse {} got {}", e, index);
+        }
+
+        assert::critical(!allocator.allocate().has_value(), "every index was reused but the allocator isn't full");
+
+        bool threw = false;
+
+        try
+        {
+            allocator.free(10);
+            allocator.free(10);
+        }
+        catch (const IndexAllocator::DoubleFree&)
+        {
+            threw = true;
+        }
+
+        assert::critical(threw, "double free wasn't detected");
+    }
+
+    void testUpperBoundScanBack()
+    {
+        IndexAllocator allocator {1024};
+
+        for (u32 i = 0; i < 300; ++i)
+        {
+            std::ignore = allocator.allocateOrPanic();
+        }
+
+        // Freeing below the top leaves the bound alone
+        allocator.free(100);
+        assert::critical(allocator.getUpperBoundOnAllocatedElements() == 300, "freeing 100 moved the bound");
+
+        allocator.free(299);
+        assert::critical(allocator.getUpperBoundOnAllocatedElements() == 299, "freeing the top didn't move the bound");
+
+        // Leave a gap spanning whole words so the scan has to walk back past empty ones
+        for (u32 i = 101; i < 299; ++i)
+        {
+            allocator.free(i);
+        }
+
+        assert::critical(
+            allocator.getUpperBoundOnAllocatedElements() == 100,
+            "bound should fall back to 100, got {}",
+            allocator.getUpperBoundOnAllocatedElements());
+
+        // Word boundaries, the highest alive block sits in bit 63 and then bit 0
+        allocator.free(99);
+        for (u32 i = 64; i < 99; ++i)
+        {
+            allocator.free(i);
+        }
+        assert::critical(allocator.getUpperBoundOnAllocatedElements() == 64, "bound should be 64");
+
+        allocator.free(63);
+        for (u32 i = 1; i < 63; ++i)
+        {
+            allocator.free(i);
+        }
+        assert::critical(allocator.getUpperBoundOnAllocatedElements() == 1, "bound should be 1");
+
+        allocator.free(0);
+        assert::critical(allocator.getUpperBoundOnAllocatedElements() == 0, "an empty allocator has a bound");
+    }
+
+    // Random churn against a reference, over enough blocks for three levels of summaries
+    void testAgainstReference()
+    {
+        constexpr u32 Blocks = 70000;
+
+        IndexAllocator                     allocator {Blocks};
+        std::set<u32>                      alive {};
+        std::set<u32>                      unallocated {};
+        std::vector<u32>                   aliveInAllocationOrder {};
+        std::minstd_rand0                  gen {7};
+        std::uniform_int_distribution<u32> actionDist {0, 2};
+
+        for (u32 i = 0; i < Blocks; ++i)
+        {
+            unallocated.insert(i);
+        }
+
+        for (u32 i = 0; i < 400000; ++i)
+        {
+            // Allocating twice as often as freeing eventually fills the allocator
+            if ((actionDist(gen) != 0 || alive.empty()) && !unallocated.empty())
+            {
+                const u32 index = allocator.allocateOrPanic();
+
+                assert::critical(index == *unallocated.begin(), "expected {} got {}", *unallocated.begin(), index);
+
+                unallocated.erase(unallocated.begin());
+                alive.insert(index);
+                aliveInAllocationOrder.push_back(index);
+            }
+            else
+            {
+                const usize victim = std::uniform_int_distribution<usize> {0, aliveInAllocationOrder.size() - 1}(gen);
+                const u32   index  = aliveInAllocationOrder[victim];
+
+                aliveInAllocationOrder[victim] = aliveInAllocationOrder.back();
+                aliveInAllocationOrder.pop_back();
+
+                allocator.free(index);
+                alive.erase(index);
+                unallocated.insert(index);
+            }
+
+            const u32 expectedBound = alive.empty() ? 0 : *alive.rbegin() + 1;
+
+            assert::critical(
+                allocator.getUpperBoundOnAllocatedElements() == expectedBound,
+                "expected bound {} got {}",
+                expectedBound,
+                allocator.getUpperBoundOnAllocatedElements());
+        }
+
+        std::vector<u32> iterated {};
+        allocator.iterateThroughAllocatedElements(
+            [&](u32 index)
+            {
+                iterated.push_back(index);
+            });
+
+        assert::critical(std::ranges::equal(iterated, alive), "iterateThroughAllocatedElements disagrees");
+        assert::critical(allocator.getNumberAllocated() == alive.size(), "getNumberAllocated disagrees");
+    }
+} // namespace
+
+int main()
+{
+    testLowestIndexOrder();
+    testFreeThenReallocate();
+    testUpperBoundScanBack();
+    testAgainstReference();
+}
@@ -0,0 +1,152 @@
+#include "bench.hpp"
+#include "gfx/generators/voxel/data_structures.hpp"
+#include "gfx/generators/voxel/loose_spatial_grid.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <glm/gtx/norm.hpp>
+#include <random>
+#include <vector>
+
+using namespace gfx::generators::voxel; // NOLINT
+
+namespace
+{
+    constexpr u16 NumberOfLights = 8192;
+    // in chunks, lights are scattered over the whole area and every chunk in it is queried
+    constexpr i32 WorldWidth     = 32;
+    constexpr i32 WorldHeight    = 8;
+    constexpr f32 ChunkWidth     = static_cast<f32>(ChunkSizeVoxels);
+
+    struct Light
+    {
+        glm::vec3 center;
+        f32       radius;
+    };
+
+    // Same exact test LightInfluenceStorage runs on the grid's conservative results
+    bool doesCubeIntersectSphere(glm::vec3 sphereCenter, f32 radius, glm::vec3 cubeMin, glm::vec3 cubeMax)
+    {
+        return glm::distance2(sphereCenter, glm::clamp(sphereCenter, cubeMin, cubeMax)) <= radius * radius;
+    }
+
+    std::vector<Light> makeLights()
+    {
+        std::minstd_rand0                gen {7};
+        std::uniform_real_distribution<> horizontalDist {0.0, WorldWidth * ChunkWidth};
+        std::uniform_real_distribution<> verticalDist {0.0, WorldHeight * ChunkWidth};
+        // Mostly small lights with a long tail of large ones
+        std::exponential_distribution<>  radiusDist {1.0 / 24.0};
+        std::vector<Light>               lights {};
+
+        lights.reserve(NumberOfLights);
+
+        for (u16 i = 0; i < NumberOfLights; ++i)
+        {
+            lights.push_back(Light {
+                .center {horizontalDist(gen), verticalDist(gen), horizontalDist(gen)},
+                .radius {static_cast<f32>(std::min(radiusDist(gen) + 1.0, 1024.0))}});
+        }
+
+        return lights;
+    }
+
+    template<class Fn>
+    void forEachChunk(Fn&& func)
+    {
+        for (i32 x = 0; x < WorldWidth; ++x)
+        {
+            for (i32 y = 0; y < WorldHeight; ++y)
+            {
+                for (i32 z = 0; z < WorldWidth; ++z)
+                {
+                    const glm::vec3 minimum = glm::vec3 {x, y, z} * ChunkWidth;
+
+                    func(minimum, minimum + ChunkWidth);
+                }
+            }
+        }
+    }
+} // namespace
+
+int main()
+{
+    const std::vector<Light> lights = makeLights();
+
+    LooseSpatialGrid<u16> grid {ChunkWidth};
+
+    for (u16 i = 0; i < NumberOfLights; ++i)
+    {
+        grid.insert(i, lights[i].center, lights[i].radius);
+    }
+
+    u64 gridVisited = 0;
+    u64 gridHits    = 0;
+    u64 linearHits  = 0;
+
+    const auto queryGrid = [&]
+    {
+        forEachChunk(
+            [&](glm::vec3 minimum, glm::vec3 maximum)
+            {
+                grid.query(
+                    minimum,
+                    maximum,
+                    [&](u16, glm::vec3 center, f32 radius)
+                    {
+                        gridVisited += 1;
+                        gridHits += doesCubeIntersectSphere(center, radius, minimum, maximum) ? 1 : 0;
+                    });
+            });
+    };
+
+    const auto queryLinear = [&]
+    {
+        forEachChunk(
+            [&](glm::vec3 minimum, glm::vec3 maximum)
+            {
+                for (const Light& l : lights)
+                {
+                    linearHits += doesCubeIntersectSphere(l.center, l.radius, minimum, maximum) ? 1 : 0;
+                }
+            });
+    };
+
+    queryGrid();
+    queryLinear();
+
+    assert::critical(gridHits == linearHits, "grid found {} influences, linear scan {}", gridHits, linearHits);
+
+    const u64 chunks = static_cast<u64>(WorldWidth) * WorldHeight * WorldWidth;
+
+    log::info(
+        "{} lights, {} chunks, {:.1f} influences and {:.1f} candidates per chunk",
+        NumberOfLights,
+        chunks,
+        static_cast<f64>(linearHits) / static_cast<f64>(chunks),
+        static_cast<f64>(gridVisited) / static_cast<f64>(chunks));
+
+    const f64 gridTime   = bench::measure("query every chunk, loose grid", 16, queryGrid);
+    const f64 linearTime = bench::measure("query every chunk, linear scan", 16, queryLinear);
+
+    fmt::println("{:<48} {:>12.2f}x", "speedup", linearTime / gridTime);
+
+    // Moving lights is the other half of the cost, a linear scan has nothing to maintain
+    std::minstd_rand0                   gen {11};
+    std::uniform_real_distribution<f32> jitterDist {-4.0f, 4.0f};
+    std::vector<Light>                  moved = lights;
+
+    bench::measure(
+        "move every light, loose grid",
+        16,
+        [&]
+        {
+            for (u16 i = 0; i < NumberOfLights; ++i)
+            {
+                moved[i].center += glm::vec3 {jitterDist(gen), jitterDist(gen), jitterDist(gen)};
+
+                grid.update(i, moved[i].center, moved[i].radius);
+            }
+        });
+
+    bench::doNotOptimize(gridVisited);
+}
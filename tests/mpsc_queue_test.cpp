@@ -0,0 +1,153 @@
+#include "util/logger.hpp"
+#include "util/threads.hpp"
+#include "util/util.hpp"
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::atomic<u64> numberOfAllocations {0}; // NOLINT
+} // namespace
+
+// Counts every global allocation so the test can check that a warmed up queue doesn't make any
+void* operator new (std::size_t size)
+{
+    numberOfAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* const memory = std::malloc(size == 0 ? 1 : size); memory != nullptr)
+    {
+        return memory;
+    }
+
+    throw std::bad_alloc {};
+}
+
+void operator delete (void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete (void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace
+{
+    struct Item
+    {
+        u32 producer;
+        u32 sequence;
+    };
+
+    constexpr u32 NumberOfProducers = 8;
+    constexpr u32 ItemsPerRound     = 4096;
+
+    // Every item arrives exactly once and each producer's items arrive in the order it pushed them
+    void runRound(const util::MpscQueue<Item>& queue, std::vector<Item>& drained)
+    {
+        std::array<u32, NumberOfProducers> nextSequence {};
+        std::atomic<u32>                   producersRunning {NumberOfProducers};
+
+        const auto checkDrained = [&]
+        {
+            for (const Item& item : drained)
+            {
+                assert::critical(
+                    item.sequence == nextSequence[item.producer],
+                    "producer {} expected item {} got {}",
+                    item.producer,
+                    nextSequence[item.producer],
+                    item.sequence);
+
+                nextSequence[item.producer] += 1;
+            }
+
+            drained.clear();
+        };
+
+        {
+            std::vector<std::jthread> producers {};
+            producers.reserve(NumberOfProducers);
+
+            for (u32 p = 0; p < NumberOfProducers; ++p)
+            {
+                producers.emplace_back(
+                    [&, p]
+                    {
+                        for (u32 i = 0; i < ItemsPerRound; ++i)
+                        {
+                            queue.push(Item {.producer {p}, .sequence {i}});
+                        }
+
+                        producersRunning.fetch_sub(1);
+                    });
+            }
+
+            while (producersRunning.load() != 0)
+            {
+                queue.drain(drained);
+                checkDrained();
+            }
+        }
+
+        queue.drain(drained);
+        checkDrained();
+
+        for (u32 p = 0; p < NumberOfProducers; ++p)
+        {
+            assert::critical(
+                nextSequence[p] == ItemsPerRound, "producer {} only had {} items drained", p, nextSequence[p]);
+        }
+    }
+
+    void testPushDoesNotAllocateOnceWarm()
+    {
+        util::MpscQueue<Item> queue {};
+        std::vector<Item>     drained {};
+
+        // Nothing is drained until every push is in, so the pool has to hold all of them
+        for (u32 i = 0; i < NumberOfProducers * ItemsPerRound; ++i)
+        {
+            queue.push(Item {.producer {0}, .sequence {i}});
+        }
+
+        queue.drain(drained);
+        assert::critical(drained.size() == NumberOfProducers * ItemsPerRound, "lost items while warming up");
+        drained.clear();
+
+        const u64 allocationsBefore = numberOfAllocations.load();
+
+        for (u32 round = 0; round < 4; ++round)
+        {
+            for (u32 i = 0; i < NumberOfProducers * ItemsPerRound; ++i)
+            {
+                queue.push(Item {.producer {0}, .sequence {i}});
+            }
+
+            queue.drain(drained);
+            drained.clear();
+        }
+
+        const u64 allocations = numberOfAllocations.load() - allocationsBefore;
+
+        assert::critical(allocations == 0, "a warmed up queue made {} allocations", allocations);
+    }
+} // namespace
+
+int main()
+{
+    util::MpscQueue<Item> queue {};
+    std::vector<Item>     drained {};
+
+    for (u32 round = 0; round < 16; ++round)
+    {
+        runRound(queue, drained);
+    }
+
+    testPushDoesNotAllocateOnceWarm();
+}
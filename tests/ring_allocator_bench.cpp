@@ -0,0 +1,233 @@
+#include "util/allocators/range_allocator.hpp"
+#include "util/allocators/ring_allocator.hpp"
+#include "util/threads.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <expected>
+#include <fmt/format.h>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr u64 Capacity       = 32ull << 20;
+    constexpr u32 Alignment      = 16;
+    constexpr u32 FramesInFlight = 2;
+
+    // Both stagers stand in for BufferStager: producers copy into staging memory and queue a transfer, once a
+    // frame the consumer takes the transfers and retires the ones that are FramesInFlight frames old
+
+    class RingStager
+    {
+    public:
+        bool tryStage(u32 size, std::byte value)
+        {
+            const std::optional<util::RingAllocator::Allocation> allocation = this->ring.tryAllocate(size, Alignment);
+
+            if (!allocation.has_value())
+            {
+                return false;
+            }
+
+            std::memset(&this->memory[allocation->offset], static_cast<int>(value), size);
+
+            this->transfers.lock(
+                [&](std::vector<u64>& t)
+                {
+                    t.push_back(allocation->offset);
+                });
+
+            this->ring.close(*allocation);
+
+            return true;
+        }
+
+        void flush()
+        {
+            const std::optional<util::RingAllocator::Position> mark = this->ring.tryMark();
+
+            this->in_flight.emplace_back(mark, this->transfers.moveInner());
+
+            while (this->in_flight.size() > FramesInFlight)
+            {
+                if (this->in_flight.front().first.has_value())
+                {
+                    this->ring.release(*this->in_flight.front().first);
+                }
+
+                this->in_flight.pop_front();
+            }
+        }
+
+    private:
+        using Frame = std::pair<std::optional<util::RingAllocator::Position>, std::vector<u64>>;
+
+        util::RingAllocator           ring {Capacity};
+        std::unique_ptr<std::byte[]>  memory {new std::byte[Capacity]};
+        util::Mutex<std::vector<u64>> transfers;
+        std::deque<Frame>             in_flight;
+    };
+
+    class RangeStager
+    {
+    public:
+        RangeStager() = default;
+        ~RangeStager()
+        {
+            this->transfers.lock(
+                [&](std::vector<util::RangeAllocation>& t)
+                {
+                    this->in_flight.push_back(std::move(t));
+                });
+
+            this->allocator.lock(
+                [&](util::RangeAllocator& a)
+                {
+                    for (std::vector<util::RangeAllocation>& frame : this->in_flight)
+                    {
+                        for (util::RangeAllocation& r : frame)
+                        {
+                            a.free(std::move(r));
+                        }
+                    }
+                });
+        }
+
+        RangeStager(const RangeStager&)             = delete;
+        RangeStager(RangeStager&&)                  = delete;
+        RangeStager& operator= (const RangeStager&) = delete;
+        RangeStager& operator= (RangeStager&&)      = delete;
+
+        bool tryStage(u32 size, std::byte value)
+        {
+            std::expected<util::RangeAllocation, util::RangeAllocator::OutOfBlocks> allocation =
+                this->allocator.lock(
+                    [&](util::RangeAllocator& a)
+                    {
+                        return a.tryAllocate(size + Alignment - 1);
+                    });
+
+            if (!allocation.has_value())
+            {
+                return false;
+            }
+
+            const u64 offset =
+                (util::RangeAllocator::getOffsetofAllocation(*allocation) + Alignment - 1) & ~u64 {Alignment - 1};
+
+            std::memset(&this->memory[offset], static_cast<int>(value), size);
+
+            this->transfers.lock(
+                [&](std::vector<util::RangeAllocation>& t)
+                {
+                    t.push_back(std::move(*allocation));
+                });
+
+            return true;
+        }
+
+        void flush()
+        {
+            this->in_flight.push_back(this->transfers.moveInner());
+
+            while (this->in_flight.size() > FramesInFlight)
+            {
+                this->allocator.lock(
+                    [&](util::RangeAllocator& a)
+                    {
+                        for (util::RangeAllocation& r : this->in_flight.front())
+                        {
+                            a.free(std::move(r));
+                        }
+                    });
+
+                this->in_flight.pop_front();
+            }
+        }
+
+    private:
+        util::Mutex<util::RangeAllocator>               allocator {util::RangeAllocator {Capacity, 128 * 1024}};
+        std::unique_ptr<std::byte[]>                    memory {new std::byte[Capacity]};
+        util::Mutex<std::vector<util::RangeAllocation>> transfers;
+        std::deque<std::vector<util::RangeAllocation>>  in_flight;
+    };
+
+    template<class Stager>
+    void run(std::string_view name, u32 numberOfProducers, u32 maxSize)
+    {
+        Stager            stager {};
+        std::atomic<bool> shouldStop {false};
+        std::atomic<u64>  staged {0};
+
+        const auto start = std::chrono::steady_clock::now();
+
+        {
+            std::vector<std::jthread> producers {};
+
+            for (u32 p = 0; p < numberOfProducers; ++p)
+            {
+                producers.emplace_back(
+                    [&, p]
+                    {
+                        u64 state      = (p * 7919) + 1;
+                        u64 stagedByUs = 0;
+
+                        while (!shouldStop.load(std::memory_order_relaxed))
+                        {
+                            state ^= state << 13;
+                            state ^= state >> 7;
+                            state ^= state << 17;
+
+                            const u32 size = 16 + static_cast<u32>(state % (maxSize - 16));
+
+                            if (stager.tryStage(size, static_cast<std::byte>(p)))
+                            {
+                                stagedByUs += 1;
+                            }
+                            else
+                            {
+                                std::this_thread::yield();
+                            }
+                        }
+
+                        staged.fetch_add(stagedByUs);
+                    });
+            }
+
+            while (std::chrono::steady_clock::now() - start < std::chrono::seconds {1})
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds {500});
+
+                stager.flush();
+            }
+
+            shouldStop.store(true);
+        }
+
+        const f64 seconds = std::chrono::duration<f64> {std::chrono::steady_clock::now() - start}.count();
+
+        fmt::println(
+            "{:<6} {:>5} B {:>3} producers {:>10.2f} M stages/s",
+            name,
+            maxSize,
+            numberOfProducers,
+            static_cast<f64>(staged.load()) / seconds / 1e6);
+    }
+} // namespace
+
+int main()
+{
+    for (u32 maxSize : {256u, 4096u})
+    {
+        for (u32 numberOfProducers : {1u, 2u, 4u, 8u, 16u})
+        {
+            run<RangeStager>("range", numberOfProducers, maxSize);
+            run<RingStager>("ring", numberOfProducers, maxSize);
+        }
+    }
+}
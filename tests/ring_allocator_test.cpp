@@ -0,0 +1,179 @@
+#include "util/allocators/ring_allocator.hpp"
+#include "util/logger.hpp"
+#include "util/threads.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using util::RingAllocator;
+
+    void testWrapAndMark()
+    {
+        RingAllocator ring {1024};
+
+        const std::optional<RingAllocator::Allocation> a = ring.tryAllocate(1000, 8);
+        assert::critical(a.has_value() && a->offset == 0, "first allocation should start at 0");
+        ring.close(*a);
+
+        // Would have to wrap over space that hasn't been released
+        assert::critical(!ring.tryAllocate(100, 8).has_value(), "allocated over unreleased space");
+
+        const std::optional<RingAllocator::Position> m = ring.tryMark();
+        assert::critical(m == 1000, "mark should be at 1000");
+        ring.release(*m);
+
+        // The last 24 bytes can't fit it, so it skips to the start
+        const std::optional<RingAllocator::Allocation> b = ring.tryAllocate(100, 8);
+        assert::critical(b.has_value() && b->offset == 0, "allocation should have wrapped to 0");
+
+        // b is still open, so the mark is held back
+        assert::critical(!ring.tryMark().has_value(), "marked past an open allocation");
+
+        // A new allocation is in the next epoch and doesn't hold the pending mark back
+        const std::optional<RingAllocator::Allocation> c = ring.tryAllocate(4, 4);
+        ring.close(*b);
+
+        assert::critical(ring.tryMark() == 1124, "pending mark should have been handed out at 1124");
+        ring.close(*c);
+        assert::critical(ring.tryMark() == 1128, "mark should be at 1128");
+
+        const std::optional<RingAllocator::Allocation> d = ring.tryAllocate(3, 1);
+        const std::optional<RingAllocator::Allocation> e = ring.tryAllocate(8, 16);
+        assert::critical(
+            d.has_value() && e.has_value() && d->offset == 104 && e->offset == 112, "alignment padding is wrong");
+        ring.close(*d);
+        ring.close(*e);
+    }
+
+    struct StagedWrite
+    {
+        u64 offset;
+        u64 size;
+        u32 tag;
+    };
+
+    // Producers reserve, fill and commit while a single consumer marks and retires with a couple of frames of
+    // latency, like BufferStager. The ring is small enough that it wraps around thousands of times, any
+    // allocation that overlaps one that hasn't been retired yet shows up as a torn write
+    void testMultiProducerWraparound()
+    {
+        constexpr u64   Capacity          = 64 * 1024;
+        constexpr u32   NumberOfProducers = 8;
+        constexpr u32   WritesPerProducer = 20000;
+        constexpr usize FramesInFlight    = 2;
+
+        RingAllocator                         ring {Capacity};
+        std::unique_ptr<u32[]>                memory = std::make_unique<u32[]>(Capacity / sizeof(u32));
+        util::Mutex<std::vector<StagedWrite>> committed {};
+        std::atomic<u32>                      producersRunning {NumberOfProducers};
+
+        std::vector<std::jthread> producers {};
+
+        for (u32 p = 0; p < NumberOfProducers; ++p)
+        {
+            producers.emplace_back(
+                [&, p]
+                {
+                    u64 state = (p * 7919) + 1;
+
+                    for (u32 i = 0; i < WritesPerProducer; ++i)
+                    {
+                        state ^= state << 13;
+                        state ^= state >> 7;
+                        state ^= state << 17;
+
+                        const u64 size = 16 * (1 + (state % 256));
+                        const u32 tag  = (i * NumberOfProducers) + p;
+
+                        std::optional<RingAllocator::Allocation> allocation = std::nullopt;
+
+                        while (!(allocation = ring.tryAllocate(size, 16)).has_value())
+                        {
+                            std::this_thread::yield();
+                        }
+
+                        std::fill_n(&memory[allocation->offset / sizeof(u32)], size / sizeof(u32), tag);
+
+                        committed.lock(
+                            [&](std::vector<StagedWrite>& c)
+                            {
+                                c.push_back(StagedWrite {.offset {allocation->offset}, .size {size}, .tag {tag}});
+                            });
+
+                        ring.close(*allocation);
+                    }
+
+                    producersRunning.fetch_sub(1);
+                });
+        }
+
+        std::deque<std::pair<std::optional<RingAllocator::Position>, std::vector<StagedWrite>>> inFlight {};
+
+        u64 verified = 0;
+        u64 torn     = 0;
+        u64 lastMark = 0;
+
+        const auto retireOldest = [&]
+        {
+            auto& [mark, writes] = inFlight.front();
+
+            for (const StagedWrite& w : writes)
+            {
+                for (u64 i = 0; i < w.size / sizeof(u32); ++i)
+                {
+                    if (memory[(w.offset / sizeof(u32)) + i] != w.tag)
+                    {
+                        torn += 1;
+
+                        break;
+                    }
+                }
+
+                verified += 1;
+            }
+
+            if (mark.has_value())
+            {
+                ring.release(*mark);
+                lastMark = *mark;
+            }
+
+            inFlight.pop_front();
+        };
+
+        while (producersRunning.load() != 0 || ring.getBytesInUse() != 0)
+        {
+            // Marking before taking the writes means every write below the mark is in this batch or an older one
+            std::optional<RingAllocator::Position> mark = ring.tryMark();
+
+            inFlight.emplace_back(mark, committed.moveInner());
+
+            while (inFlight.size() > FramesInFlight || (producersRunning.load() == 0 && !inFlight.empty()))
+            {
+                retireOldest();
+            }
+
+            std::this_thread::yield();
+        }
+
+        producers.clear();
+
+        const u64 totalWrites = u64 {NumberOfProducers} * WritesPerProducer;
+
+        assert::critical(torn == 0, "{} writes were overwritten before they were retired", torn);
+        assert::critical(verified == totalWrites, "retired {} writes out of {}", verified, totalWrites);
+        assert::critical(lastMark > Capacity * 100, "ring only got to {}, it should have wrapped", lastMark);
+    }
+} // namespace
+
+int main()
+{
+    testWrapAndMark();
+    testMultiProducerWraparound();
+}
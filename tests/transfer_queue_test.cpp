@@ -0,0 +1,505 @@
+#include "gfx/core/vulkan/transfer_queue.hpp"
+#include "util/logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <source_location>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    using gfx::core::vulkan::TransferQueue;
+
+    constexpr usize StagingSize    = 64 * 1024;
+    constexpr usize FramesInFlight = 2;
+
+    // Stands in for the gpu and BufferStager. Every flush is copied into the fake buffers only when it retires a
+    // couple of flushes later, so staging memory that is reused too early shows up in the buffers' contents
+    class FakeGpu
+    {
+    public:
+        explicit FakeGpu(std::span<const std::byte> stagingMemory_, const TransferQueue& queue_)
+            : staging_memory {stagingMemory_}
+            , queue {queue_}
+        {}
+
+        vk::Buffer makeBuffer(usize size)
+        {
+            this->buffers.emplace_back(size, std::byte {0});
+
+            // NOLINTNEXTLINE
+            return vk::Buffer {reinterpret_cast<VkBuffer>(static_cast<std::uintptr_t>(this->buffers.size()))};
+        }
+
+        [[nodiscard]] std::span<const std::byte> getContents(vk::Buffer buffer) const
+        {
+            return this->buffers[getIndex(buffer)];
+        }
+
+        void frame()
+        {
+            TransferQueue::Flush flush = this->queue.flush();
+
+            this->in_flight.push_back(InFlight {
+                .transfers {flush.transfers.begin(), flush.transfers.end()},
+                .ring_position {flush.ring_position},
+                .completed_uploads {std::move(flush.completed_uploads)},
+            });
+
+            while (this->in_flight.size() > FramesInFlight)
+            {
+                this->retireOldest();
+            }
+        }
+
+        // Runs frames until nothing has been staged for long enough that every streamed upload must be done
+        void settle()
+        {
+            usize idleFrames = 0;
+
+            for (usize i = 0; i < 100000 && idleFrames <= FramesInFlight + 1; ++i)
+            {
+                this->frame();
+
+                idleFrames = this->in_flight.back().transfers.empty() ? idleFrames + 1 : 0;
+            }
+
+            while (!this->in_flight.empty())
+            {
+                this->retireOldest();
+            }
+
+            assert::critical(
+                idleFrames > FramesInFlight + 1,
+                "TransferQueue never went idle, {} bytes in use",
+                this->queue.getBytesInUse());
+        }
+
+    private:
+        struct InFlight
+        {
+            std::vector<TransferQueue::Transfer>            transfers;
+            std::optional<util::RingAllocator::Position>    ring_position;
+            std::vector<std::shared_ptr<std::atomic<bool>>> completed_uploads;
+        };
+
+        void retireOldest()
+        {
+            InFlight& oldest = this->in_flight.front();
+
+            // The regions of a copy must not overlap, it would leave their order up to the gpu
+            std::vector<TransferQueue::Transfer> sorted = oldest.transfers;
+            std::ranges::sort(
+                sorted,
+                [](const TransferQueue::Transfer& l, const TransferQueue::Transfer& r)
+                {
+                    return std::pair {getIndex(l.output_buffer), l.output_offset}
+                         < std::pair {getIndex(r.output_buffer), r.output_offset};
+                });
+
+            for (usize i = 1; i < sorted.size(); ++i)
+            {
+                assert::critical(
+                    sorted[i - 1].output_buffer != sorted[i].output_buffer
+                        || sorted[i - 1].output_offset + sorted[i - 1].size <= sorted[i].output_offset,
+                    "transfers at {} and {} overlap in one flush",
+                    sorted[i - 1].output_offset,
+                    sorted[i].output_offset);
+            }
+
+            // Backwards, nothing may depend on the order of a copy's regions
+            for (const TransferQueue::Transfer& t : std::views::reverse(oldest.transfers))
+            {
+                std::vector<std::byte>& output = this->buffers[getIndex(t.output_buffer)];
+
+                assert::critical(t.output_offset + t.size <= output.size(), "transfer is out of its buffer's bounds");
+
+                std::memcpy(output.data() + t.output_offset, this->staging_memory.data() + t.staging_offset, t.size);
+            }
+
+            if (oldest.ring_position.has_value())
+            {
+                this->queue.release(*oldest.ring_position);
+            }
+
+            for (const std::shared_ptr<std::atomic<bool>>& complete : oldest.completed_uploads)
+            {
+                complete->store(true, std::memory_order_release);
+            }
+
+            this->in_flight.pop_front();
+        }
+
+        static usize getIndex(vk::Buffer buffer)
+        {
+            return std::bit_cast<std::uintptr_t>(static_cast<VkBuffer>(buffer)) - 1;
+        }
+
+        std::span<const std::byte>          staging_memory;
+        const TransferQueue&                queue;
+        std::vector<std::vector<std::byte>> buffers;
+        std::deque<InFlight>                in_flight;
+    };
+
+    std::vector<std::byte> filled(usize size, u8 value)
+    {
+        return std::vector<std::byte>(size, std::byte {value});
+    }
+
+    void checkContents(std::span<const std::byte> actual, std::span<const std::byte> expected, const char* test)
+    {
+        const auto [actualIt, expectedIt] = std::ranges::mismatch(actual, expected);
+
+        assert::critical(
+            actualIt == actual.end(),
+            "{}: buffers differ first at byte {}",
+            test,
+            static_cast<usize>(actualIt - actual.begin()));
+    }
+
+    // Everything lands in one flush, later writes must win wherever they overlap earlier ones
+    void testOverlapsInOneFlush()
+    {
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        const vk::Buffer       buffer   = gpu.makeBuffer(256);
+        const vk::Buffer       other    = gpu.makeBuffer(256);
+        std::vector<std::byte> expected = filled(256, 0);
+
+        const auto write = [&](u32 offset, usize size, u8 value)
+        {
+            queue.enqueueByteTransfer(buffer, offset, filled(size, value), std::source_location::current());
+            queue.enqueueByteTransfer(other, 0, filled(256, value), std::source_location::current());
+
+            std::ranges::fill_n(expected.begin() + offset, static_cast<isize>(size), std::byte {value});
+        };
+
+        write(0, 100, 1);
+        write(50, 100, 2);
+        write(20, 10, 3);
+        write(40, 20, 4);
+        write(120, 100, 5);
+        write(100, 20, 6);
+        write(200, 56, 7);
+        write(210, 10, 8);
+
+        std::optional<TransferQueue::Reservation> reservation = queue.reserveByteTransfer(buffer, 10, 100, 1);
+        assert::critical(reservation.has_value(), "couldn't reserve");
+        std::ranges::fill(reservation->getBytes(), std::byte {9});
+        queue.commit(std::move(*reservation));
+        std::ranges::fill_n(expected.begin() + 10, 100, std::byte {9});
+
+        gpu.settle();
+
+        checkContents(gpu.getContents(buffer), expected, "testOverlapsInOneFlush");
+        checkContents(gpu.getContents(other), filled(256, 8), "testOverlapsInOneFlush");
+    }
+
+    // A streamed upload takes several frames, small writes made after it to the same range must still land on top
+    void testWritesAfterStreamedUpload()
+    {
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        constexpr usize BufferSize = StagingSize * 4;
+
+        const vk::Buffer       buffer   = gpu.makeBuffer(BufferSize);
+        std::vector<std::byte> expected = filled(BufferSize, 0xAA);
+
+        const TransferQueue::UploadToken token = queue.enqueueStreamedByteTransfer(
+            buffer, 0, filled(BufferSize, 0xAA), std::source_location::current());
+
+        const std::vector<std::byte> head = filled(64, 0x01);
+        const std::vector<std::byte> tail = filled(64, 0x02);
+
+        queue.enqueueByteTransfer(buffer, 100, std::span<const std::byte> {head}, std::source_location::current());
+        std::ranges::copy(head, expected.begin() + 100);
+
+        assert::critical(
+            !queue.reserveByteTransfer(buffer, 300, 64, 1).has_value(),
+            "reserved in place over a streamed upload that was waiting");
+
+        gpu.frame();
+
+        // Still waiting on the rest of the upload
+        queue.enqueueByteTransfer(
+            buffer, BufferSize - 1000, std::span<const std::byte> {tail}, std::source_location::current());
+        std::ranges::copy(tail, expected.begin() + (BufferSize - 1000));
+
+        gpu.settle();
+
+        assert::critical(token.isComplete(), "streamed upload never completed");
+        checkContents(gpu.getContents(buffer), expected, "testWritesAfterStreamedUpload");
+
+        std::optional<TransferQueue::Reservation> reservation = queue.reserveByteTransfer(buffer, 0, 64, 1);
+        assert::critical(reservation.has_value(), "couldn't reserve once the streamed upload was done");
+        queue.cancel(std::move(*reservation));
+    }
+
+    // Only transfers that overlap a waiting streamed upload are held back behind it
+    void testUnrelatedWritesNotHeldBack()
+    {
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        constexpr usize StreamedSize = StagingSize * 8;
+
+        const vk::Buffer streamed = gpu.makeBuffer(StreamedSize);
+        const vk::Buffer other    = gpu.makeBuffer(256);
+
+        const TransferQueue::UploadToken token = queue.enqueueStreamedByteTransfer(
+            streamed, 64, filled(StreamedSize - 64, 0xAA), std::source_location::current());
+
+        // Same buffer but before the upload, and another buffer entirely
+        queue.enqueueByteTransfer(streamed, 0, filled(64, 0x01), std::source_location::current());
+
+        std::optional<TransferQueue::Reservation> reservation = queue.reserveByteTransfer(other, 0, 256, 1);
+        assert::critical(reservation.has_value(), "couldn't reserve a range no streamed upload overlaps");
+        std::ranges::fill(reservation->getBytes(), std::byte {0x02});
+        queue.commit(std::move(*reservation));
+
+        for (usize i = 0; i <= FramesInFlight; ++i)
+        {
+            gpu.frame();
+        }
+
+        assert::critical(!token.isComplete(), "streamed upload should still be in flight");
+        checkContents(gpu.getContents(streamed).first(64), filled(64, 0x01), "testUnrelatedWritesNotHeldBack");
+        checkContents(gpu.getContents(other), filled(256, 0x02), "testUnrelatedWritesNotHeldBack");
+
+        gpu.settle();
+
+        assert::critical(token.isComplete(), "streamed upload never completed");
+        checkContents(
+            gpu.getContents(streamed).subspan(64), filled(StreamedSize - 64, 0xAA), "testUnrelatedWritesNotHeldBack");
+    }
+
+    // A transfer that doesn't fit falls back to streaming, smaller ones after it that would still fit mustn't
+    // overtake it
+    void testWritesAfterFallback()
+    {
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        constexpr usize WriteSize = (StagingSize / 2) - 1024;
+
+        const vk::Buffer       buffer   = gpu.makeBuffer(WriteSize);
+        std::vector<std::byte> expected = filled(WriteSize, 0x03);
+
+        queue.enqueueByteTransfer(buffer, 0, filled(WriteSize, 0x01), std::source_location::current());
+        queue.enqueueByteTransfer(buffer, 0, filled(WriteSize, 0x02), std::source_location::current());
+        // Doesn't fit in what's left
+        queue.enqueueByteTransfer(buffer, 0, filled(WriteSize, 0x03), std::source_location::current());
+
+        queue.enqueueByteTransfer(buffer, 16, filled(16, 0x04), std::source_location::current());
+        std::ranges::fill(expected.begin() + 16, expected.begin() + 32, std::byte {0x04});
+
+        gpu.settle();
+
+        checkContents(gpu.getContents(buffer), expected, "testWritesAfterFallback");
+    }
+
+    // Random overlapping writes of every kind, the buffers must end up as if they were applied in order
+    void testRandomWrites()
+    {
+        constexpr usize NumberOfBuffers = 4;
+        constexpr usize BufferSize      = StagingSize * 2;
+        constexpr usize NumberOfWrites  = 20000;
+
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        std::vector<vk::Buffer>             buffers {};
+        std::vector<std::vector<std::byte>> expected {};
+
+        for (usize i = 0; i < NumberOfBuffers; ++i)
+        {
+            buffers.push_back(gpu.makeBuffer(BufferSize));
+            expected.push_back(filled(BufferSize, 0));
+        }
+
+        std::mt19937_64                         rng {0xC1AAB};
+        std::vector<TransferQueue::UploadToken> tokens {};
+
+        for (usize i = 0; i < NumberOfWrites; ++i)
+        {
+            const usize whichBuffer = rng() % NumberOfBuffers;
+            const u8    value       = static_cast<u8>((i % 255) + 1);
+
+            // Mostly small, with the occasional one too large to stage directly
+            const usize size   = rng() % 64 == 0 ? 1 + (rng() % (BufferSize / 2)) : 1 + (rng() % 2048);
+            const u32   offset = static_cast<u32>(rng() % (BufferSize - size + 1));
+
+            std::vector<std::byte> data = filled(size, value);
+            bool                   kept = true;
+
+            switch (rng() % 4)
+            {
+            case 0:
+                tokens.push_back(queue.enqueueStreamedByteTransfer(
+                    buffers[whichBuffer], offset, std::move(data), std::source_location::current()));
+                break;
+            case 1:
+                if (std::optional<TransferQueue::Reservation> reservation =
+                        queue.reserveByteTransfer(buffers[whichBuffer], offset, static_cast<u32>(size), 1))
+                {
+                    std::ranges::copy(data, reservation->getBytes().begin());
+
+                    if (rng() % 8 == 0)
+                    {
+                        queue.cancel(std::move(*reservation));
+                        kept = false;
+                    }
+                    else
+                    {
+                        queue.commit(std::move(*reservation));
+                    }
+
+                    break;
+                }
+                [[fallthrough]];
+            case 2:
+                queue.enqueueByteTransfer(
+                    buffers[whichBuffer], offset, std::span<const std::byte> {data}, std::source_location::current());
+                break;
+            default:
+                queue.enqueueByteTransfer(
+                    buffers[whichBuffer], offset, std::move(data), std::source_location::current());
+                break;
+            }
+
+            if (kept)
+            {
+                std::ranges::fill_n(
+                    expected[whichBuffer].begin() + offset, static_cast<isize>(size), std::byte {value});
+            }
+
+            // Rarely enough that the ring fills up and transfers fall back to streaming
+            if (rng() % 16 == 0)
+            {
+                gpu.frame();
+            }
+        }
+
+        gpu.settle();
+
+        for (const TransferQueue::UploadToken& token : tokens)
+        {
+            assert::critical(token.isComplete(), "streamed upload never completed");
+        }
+
+        for (usize i = 0; i < NumberOfBuffers; ++i)
+        {
+            checkContents(gpu.getContents(buffers[i]), expected[i], "testRandomWrites");
+        }
+
+        assert::critical(queue.getBytesInUse() == 0, "{} bytes still in use", queue.getBytesInUse());
+    }
+
+    // Producers each write to their own buffer while the main thread flushes, ordering only holds per producer
+    void testConcurrentProducers()
+    {
+        constexpr usize NumberOfProducers = 4;
+        constexpr usize BufferSize        = StagingSize;
+        constexpr usize WritesPerProducer = 4000;
+
+        std::vector<std::byte> staging(StagingSize);
+        TransferQueue          queue {staging};
+        FakeGpu                gpu {staging, queue};
+
+        std::vector<vk::Buffer>             buffers {};
+        std::vector<std::vector<std::byte>> expected {};
+
+        for (usize i = 0; i < NumberOfProducers; ++i)
+        {
+            buffers.push_back(gpu.makeBuffer(BufferSize));
+            expected.push_back(filled(BufferSize, 0));
+        }
+
+        std::atomic<usize>        producersRunning {NumberOfProducers};
+        std::vector<std::jthread> producers {};
+
+        for (usize p = 0; p < NumberOfProducers; ++p)
+        {
+            producers.emplace_back(
+                [&, p]
+                {
+                    std::mt19937_64 rng {p};
+
+                    for (usize i = 0; i < WritesPerProducer; ++i)
+                    {
+                        const u8    value  = static_cast<u8>((i % 255) + 1);
+                        const usize size   = rng() % 128 == 0 ? 1 + (rng() % BufferSize) : 1 + (rng() % 1024);
+                        const u32   offset = static_cast<u32>(rng() % (BufferSize - size + 1));
+
+                        std::optional<TransferQueue::Reservation> reservation =
+                            rng() % 2 == 0 ? queue.reserveByteTransfer(buffers[p], offset, static_cast<u32>(size), 1)
+                                           : std::nullopt;
+
+                        if (reservation.has_value())
+                        {
+                            std::ranges::fill(reservation->getBytes(), std::byte {value});
+                            queue.commit(std::move(*reservation));
+                        }
+                        else if (rng() % 2 == 0)
+                        {
+                            queue.enqueueByteTransfer(
+                                buffers[p], offset, filled(size, value), std::source_location::current());
+                        }
+                        else
+                        {
+                            std::ignore = queue.enqueueStreamedByteTransfer(
+                                buffers[p], offset, filled(size, value), std::source_location::current());
+                        }
+
+                        std::ranges::fill_n(expected[p].begin() + offset, static_cast<isize>(size), std::byte {value});
+                    }
+
+                    producersRunning.fetch_sub(1);
+                });
+        }
+
+        while (producersRunning.load() != 0)
+        {
+            gpu.frame();
+
+            std::this_thread::yield();
+        }
+
+        producers.clear();
+
+        gpu.settle();
+
+        for (usize i = 0; i < NumberOfProducers; ++i)
+        {
+            checkContents(gpu.getContents(buffers[i]), expected[i], "testConcurrentProducers");
+        }
+    }
+} // namespace
+
+int main()
+{
+    testOverlapsInOneFlush();
+    testWritesAfterStreamedUpload();
+    testUnrelatedWritesNotHeldBack();
+    testWritesAfterFallback();
+    testRandomWrites();
+    testConcurrentProducers();
+
+    log::info("TransferQueue tests passed");
+}